@@ -0,0 +1,168 @@
+//
+// Bounding boxes and spheres for culling
+// The vertex data is int32 or float x/y/z with a stride, either walked in order or through an index list.
+// With SSE2 one vertex is a single 128 bit lane set: converted to float, then min/max for the box
+// and a squared distance for the sphere, so no component is handled on its own. The sphere is
+// centred on the box and its radius is the farthest vertex, a second pass over the same vertices.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+
+#include "wipeout_definitions.h"
+
+#if defined( _M_X64 ) || defined( __SSE2__ ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define BOUNDS_SSE2 1
+#include <emmintrin.h>
+#else
+#define BOUNDS_SSE2 0
+#endif
+
+inline Bounds bounds_empty()
+{
+	Bounds bounds;
+	for ( int k = 0; k < 3; k++ )
+	{
+		bounds.lo[k] = FLT_MAX;
+		bounds.hi[k] = -FLT_MAX;
+		bounds.center[k] = 0;
+	}
+	bounds.radius = -1;
+	return bounds;
+}
+
+inline bool bounds_isEmpty( const Bounds &bounds )
+{
+	return bounds.radius < 0;
+}
+
+#if BOUNDS_SSE2
+// x y z 0, a stride of 3 can't load four ints at the last vertex without reading past the array,
+// and with a wider stride the fourth int is whatever follows z (TrackVertex padding) so it is masked off
+inline __m128 bounds_load( const int32_t *p, size_t stride, const float *offset )
+{
+	__m128i v = stride >= 4 ? _mm_and_si128( _mm_loadu_si128( (const __m128i*)p ), _mm_setr_epi32( -1, -1, -1, 0 ) ) : _mm_setr_epi32( p[0], p[1], p[2], 0 );
+	__m128 f = _mm_cvtepi32_ps( v );
+	return _mm_add_ps( f, _mm_setr_ps( offset[0], offset[1], offset[2], 0 ) );
+}
+
+inline __m128 bounds_load( const float *p, size_t stride, const float *offset )
+{
+	__m128 f = stride >= 4 ? _mm_and_ps( _mm_loadu_ps( p ), _mm_castsi128_ps( _mm_setr_epi32( -1, -1, -1, 0 ) ) ) : _mm_setr_ps( p[0], p[1], p[2], 0 );
+	return _mm_add_ps( f, _mm_setr_ps( offset[0], offset[1], offset[2], 0 ) );
+}
+#endif
+
+// vertex i is at xyz + index( i ) * stride, moved by offset
+template <typename T, typename Index>
+inline Bounds bounds_compute( const T *xyz, size_t stride, size_t count, Index index, const float *offset )
+{
+	Bounds bounds = bounds_empty();
+	if ( count == 0 )
+		return bounds;
+
+#if BOUNDS_SSE2
+	__m128 lo = _mm_set1_ps( FLT_MAX ), hi = _mm_set1_ps( -FLT_MAX );
+	for ( size_t i = 0; i < count; i++ )
+	{
+		__m128 v = bounds_load( xyz + index( i ) * stride, stride, offset );
+		lo = _mm_min_ps( lo, v );
+		hi = _mm_max_ps( hi, v );
+	}
+
+	float store[4];
+	_mm_storeu_ps( store, lo );
+	std::copy( store, store + 3, bounds.lo );
+	_mm_storeu_ps( store, hi );
+	std::copy( store, store + 3, bounds.hi );
+
+	__m128 center = _mm_mul_ps( _mm_add_ps( lo, hi ), _mm_set1_ps( 0.5f ) );
+	_mm_storeu_ps( store, center );
+	std::copy( store, store + 3, bounds.center );
+
+	// bounds_load zeroes the w lane, so it is 0 - 0 and summing all four lanes is the squared length
+	__m128 farthest = _mm_setzero_ps();
+	for ( size_t i = 0; i < count; i++ )
+	{
+		__m128 d = _mm_sub_ps( bounds_load( xyz + index( i ) * stride, stride, offset ), center );
+		d = _mm_mul_ps( d, d );
+		d = _mm_add_ps( d, _mm_shuffle_ps( d, d, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+		d = _mm_add_ps( d, _mm_shuffle_ps( d, d, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+		farthest = _mm_max_ps( farthest, d );
+	}
+	bounds.radius = sqrtf( _mm_cvtss_f32( farthest ) );
+#else
+	for ( size_t i = 0; i < count; i++ )
+	{
+		const T *p = xyz + index( i ) * stride;
+		for ( int k = 0; k < 3; k++ )
+		{
+			bounds.lo[k] = std::min( bounds.lo[k], (float)p[k] + offset[k] );
+			bounds.hi[k] = std::max( bounds.hi[k], (float)p[k] + offset[k] );
+		}
+	}
+	for ( int k = 0; k < 3; k++ )
+		bounds.center[k] = ( bounds.lo[k] + bounds.hi[k] ) * 0.5f;
+
+	float farthest = 0;
+	for ( size_t i = 0; i < count; i++ )
+	{
+		const T *p = xyz + index( i ) * stride;
+		float d[3] = { (float)p[0] + offset[0] - bounds.center[0], (float)p[1] + offset[1] - bounds.center[1], (float)p[2] + offset[2] - bounds.center[2] };
+		farthest = std::max( farthest, d[0] * d[0] + d[1] * d[1] + d[2] * d[2] );
+	}
+	bounds.radius = sqrtf( farthest );
+#endif
+
+	return bounds;
+}
+
+/// <summary> Bounds of count consecutive vertices, each stride int32s after the last. </summary>
+inline Bounds bounds_points( const int32_t *xyz, size_t stride, size_t count, const float *offset )
+{
+	return bounds_compute( xyz, stride, count, []( size_t i ) { return i; }, offset );
+}
+
+/// <summary> Bounds of the vertices picked by an index list, repeats are fine. </summary>
+inline Bounds bounds_indexed( const int32_t *xyz, size_t stride, const uint32_t *indices, size_t count )
+{
+	const float offset[3] = { 0, 0, 0 };
+	return bounds_compute( xyz, stride, count, [indices]( size_t i ) { return (size_t)indices[i]; }, offset );
+}
+
+/// <summary> Bounds of count consecutive float vertices, each stride floats after the last. </summary>
+inline Bounds bounds_floats( const float *xyz, size_t stride, size_t count )
+{
+	const float offset[3] = { 0, 0, 0 };
+	return bounds_compute( xyz, stride, count, []( size_t i ) { return i; }, offset );
+}
+
+/// <summary> Box around both boxes and a sphere on its centre around both spheres. </summary>
+inline Bounds bounds_merge( const Bounds &a, const Bounds &b )
+{
+	if ( bounds_isEmpty( a ) )
+		return b;
+	if ( bounds_isEmpty( b ) )
+		return a;
+
+	Bounds bounds;
+	for ( int k = 0; k < 3; k++ )
+	{
+		bounds.lo[k] = std::min( a.lo[k], b.lo[k] );
+		bounds.hi[k] = std::max( a.hi[k], b.hi[k] );
+		bounds.center[k] = ( bounds.lo[k] + bounds.hi[k] ) * 0.5f;
+	}
+
+	auto reach = [&bounds]( const Bounds &part )
+	{
+		float d[3] = { part.center[0] - bounds.center[0], part.center[1] - bounds.center[1], part.center[2] - bounds.center[2] };
+		return sqrtf( d[0] * d[0] + d[1] * d[1] + d[2] * d[2] ) + part.radius;
+	};
+	bounds.radius = std::max( reach( a ), reach( b ) );
+
+	return bounds;
+}
@@ -0,0 +1,257 @@
+//
+// Binary glTF 2.0 (.glb) writer
+// Every mesh becomes a node with its translation. Vertices are interleaved position/uv/color in one
+// buffer view per mesh, each primitive has its own index buffer and one material per texture. Indices
+// are uint16 when the mesh has fewer than 65536 vertices (65535 is the restart value) and uint32 otherwise.
+// Textures are embedded as .png, everything is written little endian straight from memory.
+// Given bounds, each node carries its world space box and sphere in extras for culling.
+// Meshes with object ids get an _OBJECT_ID float attribute, floats since gltf has no 4 byte aligned
+// 16 bit scalar attribute and 32 bit integers are index only.
+//
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <cstddef>
+#include <algorithm>
+#include <charconv>
+#include <string>
+#include <vector>
+
+#include "wipeout_definitions.h"
+#include "png.h"
+
+inline std::string glb_float( float value )
+{
+	char buffer[32];
+	std::to_chars_result result = std::to_chars( buffer, buffer + sizeof(buffer), value );
+	return std::string( buffer, result.ptr );
+}
+
+inline std::string glb_string( const std::string &text )
+{
+	std::string out = "\"";
+	for ( size_t i = 0; i < text.size(); i++ )
+	{
+		unsigned char c = (unsigned char)text[i];
+		if ( c == '"' || c == '\\' )
+		{
+			out += '\\';
+			out += (char)c;
+		}
+		else if ( c < 0x20 )
+		{
+			char escape[8];
+			snprintf( escape, sizeof(escape), "\\u%04x", c );
+			out += escape;
+		}
+		else
+			out += (char)c;
+	}
+	return out + "\"";
+}
+
+inline void glb_put32( std::vector<uint8_t> &out, uint32_t v )
+{
+	uint8_t bytes[4] = { (uint8_t)v, (uint8_t)( v >> 8 ), (uint8_t)( v >> 16 ), (uint8_t)( v >> 24 ) };
+	out.insert( out.end(), bytes, bytes + 4 );
+}
+
+/// <summary> Writes the meshes as one .glb scene. Primitive texture n uses textures[n], -1 gets a plain vertex colored material. </summary>
+/// <param name='textures'>Top-down RGBA images.</param>
+/// <param name='nodeBounds'>NULL or one per mesh.</param>
+inline bool glb_write( const char *filename, const std::vector<Mesh> &meshes, const std::vector<Image> &textures, const std::vector<Bounds> *nodeBounds = NULL )
+{
+	std::vector<uint8_t> bin;
+	std::string bufferViews, accessors, meshesJson, nodes, sceneNodes;
+	int viewCount = 0, accessorCount = 0, meshCount = 0;
+
+	// all views start 4 byte aligned, which covers every component type used here
+	auto addView = [&]( const void *data, size_t length, size_t stride, int target ) -> int
+	{
+		while ( bin.size() % 4 )
+			bin.push_back( 0 );
+
+		if ( viewCount )
+			bufferViews += ",";
+		bufferViews += "{\"buffer\":0,\"byteOffset\":" + std::to_string( bin.size() ) + ",\"byteLength\":" + std::to_string( length );
+		if ( stride )
+			bufferViews += ",\"byteStride\":" + std::to_string( stride );
+		if ( target )
+			bufferViews += ",\"target\":" + std::to_string( target );
+		bufferViews += "}";
+
+		const uint8_t *bytes = (const uint8_t*)data;
+		bin.insert( bin.end(), bytes, bytes + length );
+		return viewCount++;
+	};
+
+	auto addAccessor = [&]( int view, size_t offset, int componentType, bool bNormalized, size_t count, const char *type, const std::string &bounds ) -> int
+	{
+		if ( accessorCount )
+			accessors += ",";
+		accessors += "{\"bufferView\":" + std::to_string( view ) + ",\"byteOffset\":" + std::to_string( offset )
+			+ ",\"componentType\":" + std::to_string( componentType ) + ",\"count\":" + std::to_string( count )
+			+ ",\"type\":\"" + type + "\"";
+		if ( bNormalized )
+			accessors += ",\"normalized\":true";
+		accessors += bounds + "}";
+		return accessorCount++;
+	};
+
+	// images
+	std::string images, textureJson, materials;
+	for ( size_t i = 0; i < textures.size(); i++ )
+	{
+		std::vector<uint8_t> png = png_encode( textures[i].width, textures[i].height, textures[i].pixels.data() );
+		int view = addView( png.data(), png.size(), 0, 0 );
+
+		std::string sep = i ? "," : "";
+		images += sep + "{\"bufferView\":" + std::to_string( view ) + ",\"mimeType\":\"image/png\"}";
+		textureJson += sep + "{\"sampler\":0,\"source\":" + std::to_string( i ) + "}";
+		materials += sep + "{\"name\":\"texture_" + std::to_string( i ) + "\",\"pbrMetallicRoughness\":{\"baseColorTexture\":{\"index\":"
+			+ std::to_string( i ) + "},\"metallicFactor\":0,\"roughnessFactor\":1},\"alphaMode\":\"MASK\",\"alphaCutoff\":0.5,\"doubleSided\":true}";
+	}
+	if ( textures.size() )
+		materials += ",";
+	materials += "{\"name\":\"untextured\",\"pbrMetallicRoughness\":{\"metallicFactor\":0,\"roughnessFactor\":1},\"doubleSided\":true}";
+	int untextured = (int)textures.size();
+
+	// meshes
+	for ( size_t m = 0; m < meshes.size(); m++ )
+	{
+		const Mesh &mesh = meshes[m];
+
+		if ( mesh.vertices.empty() )
+			continue;
+
+		float lo[3] = { mesh.vertices[0].position[0], mesh.vertices[0].position[1], mesh.vertices[0].position[2] };
+		float hi[3] = { lo[0], lo[1], lo[2] };
+		for ( size_t i = 0; i < mesh.vertices.size(); i++ )
+		{
+			for ( int k = 0; k < 3; k++ )
+			{
+				lo[k] = std::min( lo[k], mesh.vertices[i].position[k] );
+				hi[k] = std::max( hi[k], mesh.vertices[i].position[k] );
+			}
+		}
+		std::string bounds = ",\"min\":[" + glb_float( lo[0] ) + "," + glb_float( lo[1] ) + "," + glb_float( lo[2] )
+			+ "],\"max\":[" + glb_float( hi[0] ) + "," + glb_float( hi[1] ) + "," + glb_float( hi[2] ) + "]";
+
+		int vertexView = addView( mesh.vertices.data(), mesh.vertices.size() * sizeof(MeshVertex), sizeof(MeshVertex), 34962 );
+		int position = addAccessor( vertexView, offsetof( MeshVertex, position ), 5126, false, mesh.vertices.size(), "VEC3", bounds );
+		int uv = addAccessor( vertexView, offsetof( MeshVertex, uv ), 5126, false, mesh.vertices.size(), "VEC2", "" );
+		int color = addAccessor( vertexView, offsetof( MeshVertex, color ), 5121, true, mesh.vertices.size(), "VEC4", "" );
+
+		std::string objectId;
+		if ( mesh.objectIds.size() == mesh.vertices.size() )
+		{
+			std::vector<float> ids( mesh.objectIds.begin(), mesh.objectIds.end() );
+			int idView = addView( ids.data(), ids.size() * sizeof(float), 0, 34962 );
+			objectId = ",\"_OBJECT_ID\":" + std::to_string( addAccessor( idView, 0, 5126, false, ids.size(), "SCALAR", "" ) );
+		}
+
+		bool bShortIndices = mesh.vertices.size() <= 65535;
+		std::string primitives;
+		for ( size_t p = 0; p < mesh.primitives.size(); p++ )
+		{
+			const MeshPrimitive &primitive = mesh.primitives[p];
+
+			if ( primitive.indices.empty() )
+				continue;
+
+			int indexView;
+			if ( bShortIndices )
+			{
+				std::vector<uint16_t> shorts( primitive.indices.begin(), primitive.indices.end() );
+				indexView = addView( shorts.data(), shorts.size() * sizeof(uint16_t), 0, 34963 );
+			}
+			else
+				indexView = addView( primitive.indices.data(), primitive.indices.size() * sizeof(uint32_t), 0, 34963 );
+			int indices = addAccessor( indexView, 0, bShortIndices ? 5123 : 5125, false, primitive.indices.size(), "SCALAR", "" );
+			int material = primitive.texture >= 0 && primitive.texture < untextured ? primitive.texture : untextured;
+
+			if ( !primitives.empty() )
+				primitives += ",";
+			primitives += "{\"attributes\":{\"POSITION\":" + std::to_string( position ) + ",\"TEXCOORD_0\":" + std::to_string( uv )
+				+ ",\"COLOR_0\":" + std::to_string( color ) + objectId + "},\"indices\":" + std::to_string( indices )
+				+ ",\"material\":" + std::to_string( material ) + "}";
+		}
+
+		if ( primitives.empty() )
+			continue;
+
+		std::string sep = meshCount ? "," : "";
+		meshesJson += sep + "{\"name\":" + glb_string( mesh.name ) + ",\"primitives\":[" + primitives + "]}";
+		nodes += sep + "{\"name\":" + glb_string( mesh.name ) + ",\"mesh\":" + std::to_string( meshCount )
+			+ ",\"translation\":[" + glb_float( mesh.translation.x ) + "," + glb_float( mesh.translation.y ) + "," + glb_float( mesh.translation.z ) + "]";
+		if ( nodeBounds && m < nodeBounds->size() && ( *nodeBounds )[m].radius >= 0 )
+		{
+			const Bounds &b = ( *nodeBounds )[m];
+			nodes += ",\"extras\":{\"min\":[" + glb_float( b.lo[0] ) + "," + glb_float( b.lo[1] ) + "," + glb_float( b.lo[2] )
+				+ "],\"max\":[" + glb_float( b.hi[0] ) + "," + glb_float( b.hi[1] ) + "," + glb_float( b.hi[2] )
+				+ "],\"center\":[" + glb_float( b.center[0] ) + "," + glb_float( b.center[1] ) + "," + glb_float( b.center[2] )
+				+ "],\"radius\":" + glb_float( b.radius ) + "}";
+		}
+		nodes += "}";
+		sceneNodes += sep + std::to_string( meshCount );
+		meshCount++;
+	}
+
+	while ( bin.size() % 4 )
+		bin.push_back( 0 );
+
+	std::string json = "{\"asset\":{\"version\":\"2.0\",\"generator\":\"Wipeout Ripper\"},\"scene\":0";
+	if ( meshCount )
+		json += ",\"scenes\":[{\"nodes\":[" + sceneNodes + "]}],\"nodes\":[" + nodes + "],\"meshes\":[" + meshesJson + "]";
+	else
+		json += ",\"scenes\":[{}]";
+	json += ",\"materials\":[" + materials + "]";
+	if ( textures.size() )
+	{
+		// nearest filtering keeps the psx look
+		json += ",\"samplers\":[{\"magFilter\":9728,\"minFilter\":9728}]";
+		json += ",\"images\":[" + images + "],\"textures\":[" + textureJson + "]";
+	}
+	if ( accessorCount )
+		json += ",\"accessors\":[" + accessors + "]";
+	if ( viewCount )
+		json += ",\"bufferViews\":[" + bufferViews + "]";
+	if ( bin.size() )
+		json += ",\"buffers\":[{\"byteLength\":" + std::to_string( bin.size() ) + "}]";
+	json += "}";
+	while ( json.size() % 4 )
+		json += ' ';
+
+	std::vector<uint8_t> header;
+	glb_put32( header, 0x46546C67 ); // glTF
+	glb_put32( header, 2 );
+	glb_put32( header, (uint32_t)( 12 + 8 + json.size() + ( bin.size() ? 8 + bin.size() : 0 ) ) );
+	glb_put32( header, (uint32_t)json.size() );
+	glb_put32( header, 0x4E4F534A ); // JSON
+
+	FILE *fp = NULL;
+#ifdef _MSC_VER
+	fopen_s( &fp, filename, "wb" );
+#else
+	fp = fopen( filename, "wb" );
+#endif
+	if ( fp == NULL )
+		return false;
+
+	fwrite( header.data(), 1, header.size(), fp );
+	fwrite( json.data(), 1, json.size(), fp );
+	if ( bin.size() )
+	{
+		std::vector<uint8_t> chunk;
+		glb_put32( chunk, (uint32_t)bin.size() );
+		glb_put32( chunk, 0x004E4942 ); // BIN
+		fwrite( chunk.data(), 1, chunk.size(), fp );
+		fwrite( bin.data(), 1, bin.size(), fp );
+	}
+	fclose( fp );
+
+	return true;
+}
@@ -0,0 +1,141 @@
+//
+// Buffered text writer for the .obj/.mtl output
+// Numbers are formatted with to_chars straight into one large buffer which is written out
+// in big chunks, instead of a std::string per value pushed through an ofstream.
+//
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <charconv>
+#include <string>
+#include <vector>
+#include <type_traits>
+
+struct ObjWriter
+{
+	FILE			 *file;
+	std::vector<char> buffer;
+	size_t			  used;
+
+	explicit ObjWriter( size_t capacity = 4 * 1024 * 1024 )
+		: file( NULL ), buffer( capacity ), used( 0 )
+	{
+	}
+
+	explicit ObjWriter( const std::string &fileName, size_t capacity = 4 * 1024 * 1024 )
+		: file( NULL ), buffer( capacity ), used( 0 )
+	{
+		open( fileName );
+	}
+
+	~ObjWriter()
+	{
+		close();
+	}
+
+	ObjWriter( const ObjWriter& ) = delete;
+	ObjWriter &operator=( const ObjWriter& ) = delete;
+
+	// the buffer is kept, so one writer can be reused for many files
+	bool open( const std::string &fileName )
+	{
+		close();
+		// text mode, so line endings match what std::ofstream wrote
+#ifdef _MSC_VER
+		fopen_s( &file, fileName.c_str(), "w" );
+#else
+		file = fopen( fileName.c_str(), "w" );
+#endif
+		return file != NULL;
+	}
+
+	bool is_open() const
+	{
+		return file != NULL;
+	}
+
+	// without a file everything stays in the buffer, which then just grows
+	void flush()
+	{
+		if ( !file )
+			return;
+		if ( used )
+			fwrite( buffer.data(), 1, used, file );
+		used = 0;
+	}
+
+	void close()
+	{
+		flush();
+		if ( file )
+		{
+			fclose( file );
+			file = NULL;
+		}
+	}
+
+	// makes room for at least length more bytes
+	char *reserve( size_t length )
+	{
+		if ( used + length > buffer.size() )
+		{
+			flush();
+			if ( used + length > buffer.size() )
+				buffer.resize( std::max( buffer.size() * 2, used + length ) );
+		}
+		return buffer.data() + used;
+	}
+
+	void write( const char *data, size_t length )
+	{
+		memcpy( reserve( length ), data, length );
+		used += length;
+	}
+
+	ObjWriter &operator<<( const char *text )
+	{
+		write( text, strlen( text ) );
+		return *this;
+	}
+
+	ObjWriter &operator<<( const std::string &text )
+	{
+		write( text.data(), text.size() );
+		return *this;
+	}
+
+	ObjWriter &operator<<( char c )
+	{
+		*reserve( 1 ) = c;
+		used++;
+		return *this;
+	}
+
+	template <class T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+	ObjWriter &operator<<( T value )
+	{
+		char *first = reserve( 24 );
+		used = std::to_chars( first, first + 24, value ).ptr - buffer.data();
+		return *this;
+	}
+
+	// floats are always fixed with 6 decimals, the same as std::to_string
+	ObjWriter &operator<<( float value )
+	{
+		char *first = reserve( 64 );
+		std::to_chars_result result = std::to_chars( first, first + 64, value, std::chars_format::fixed, 6 );
+		if ( result.ec != std::errc() )
+		{
+			// only huge values don't fit, those never show up in uvs
+			std::string text = std::to_string( value );
+			write( text.data(), text.size() );
+			return *this;
+		}
+		used = result.ptr - buffer.data();
+		return *this;
+	}
+};
@@ -0,0 +1,115 @@
+//
+// Binary little endian .ply writer
+// All meshes go into one file, moved by their translation. Vertices are float x/y/z with uchar
+// red/green/blue, faces are triangles. The header, the vertex block and the face block are each
+// packed into one contiguous array first, so the file is written with three fwrite calls.
+//
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "wipeout_definitions.h"
+
+// ply wants little endian whatever the host is
+inline uint8_t *ply_put32( uint8_t *out, uint32_t v )
+{
+	out[0] = (uint8_t)v;
+	out[1] = (uint8_t)( v >> 8 );
+	out[2] = (uint8_t)( v >> 16 );
+	out[3] = (uint8_t)( v >> 24 );
+	return out + 4;
+}
+
+inline uint8_t *ply_putf( uint8_t *out, float f )
+{
+	uint32_t v;
+	memcpy( &v, &f, 4 );
+	return ply_put32( out, v );
+}
+
+/// <summary> Writes the triangles of all meshes as one binary little endian .ply file. </summary>
+inline bool ply_write( const char *filename, const std::vector<Mesh> &meshes )
+{
+	const size_t vertexSize = 3 * 4 + 3;	// x y z red green blue
+	const size_t faceSize = 1 + 3 * 4;		// count and three indices
+
+	size_t vertexCount = 0, faceCount = 0;
+	for ( size_t m = 0; m < meshes.size(); m++ )
+	{
+		vertexCount += meshes[m].vertices.size();
+		for ( size_t p = 0; p < meshes[m].primitives.size(); p++ )
+			faceCount += meshes[m].primitives[p].indices.size() / 3;
+	}
+
+	std::string header =
+		"ply\n"
+		"format binary_little_endian 1.0\n"
+		"comment Wipeout Ripper\n"
+		"element vertex " + std::to_string( vertexCount ) + "\n"
+		"property float x\n"
+		"property float y\n"
+		"property float z\n"
+		"property uchar red\n"
+		"property uchar green\n"
+		"property uchar blue\n"
+		"element face " + std::to_string( faceCount ) + "\n"
+		"property list uchar int vertex_indices\n"
+		"end_header\n";
+
+	std::vector<uint8_t> vertices( vertexCount * vertexSize );
+	std::vector<uint8_t> faces( faceCount * faceSize );
+	uint8_t *v = vertices.data();
+	uint8_t *f = faces.data();
+
+	uint32_t base = 0;
+	for ( size_t m = 0; m < meshes.size(); m++ )
+	{
+		const Mesh &mesh = meshes[m];
+
+		for ( size_t i = 0; i < mesh.vertices.size(); i++ )
+		{
+			const MeshVertex &vertex = mesh.vertices[i];
+			v = ply_putf( v, vertex.position[0] + mesh.translation.x );
+			v = ply_putf( v, vertex.position[1] + mesh.translation.y );
+			v = ply_putf( v, vertex.position[2] + mesh.translation.z );
+			*v++ = vertex.color[0];
+			*v++ = vertex.color[1];
+			*v++ = vertex.color[2];
+		}
+
+		for ( size_t p = 0; p < mesh.primitives.size(); p++ )
+		{
+			const std::vector<uint32_t> &indices = mesh.primitives[p].indices;
+			for ( size_t i = 0; i + 2 < indices.size(); i += 3 )
+			{
+				*f++ = 3;
+				f = ply_put32( f, base + indices[i] );
+				f = ply_put32( f, base + indices[i + 1] );
+				f = ply_put32( f, base + indices[i + 2] );
+			}
+		}
+
+		base += (uint32_t)mesh.vertices.size();
+	}
+
+	FILE *fp = NULL;
+#ifdef _MSC_VER
+	fopen_s( &fp, filename, "wb" );
+#else
+	fp = fopen( filename, "wb" );
+#endif
+	if ( fp == NULL )
+		return false;
+
+	fwrite( header.data(), 1, header.size(), fp );
+	fwrite( vertices.data(), 1, vertices.size(), fp );
+	fwrite( faces.data(), 1, faces.size(), fp );
+	fclose( fp );
+
+	return true;
+}
@@ -0,0 +1,113 @@
+//
+// Minimal .png encoder
+// Writes 8 bit RGBA with stored (uncompressed) deflate blocks, so it needs no zlib.
+// The textures are tiny, the files only end up a bit larger than the .tga ones.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+struct png_crc_table
+{
+	uint32_t entries[256];
+
+	png_crc_table()
+	{
+		for ( uint32_t n = 0; n < 256; n++ )
+		{
+			uint32_t c = n;
+			for ( int k = 0; k < 8; k++ )
+				c = ( c & 1 ) ? 0xedb88320u ^ ( c >> 1 ) : c >> 1;
+			entries[n] = c;
+		}
+	}
+};
+
+inline uint32_t png_crc32( const uint8_t *data, size_t length, uint32_t crc = 0 )
+{
+	// function static, so the table is built once even with several threads encoding
+	static const png_crc_table table;
+
+	crc = ~crc;
+	for ( size_t i = 0; i < length; i++ )
+		crc = table.entries[( crc ^ data[i] ) & 0xff] ^ ( crc >> 8 );
+	return ~crc;
+}
+
+inline void png_put32( std::vector<uint8_t> &out, uint32_t v )
+{
+	out.push_back( (uint8_t)( v >> 24 ) );
+	out.push_back( (uint8_t)( v >> 16 ) );
+	out.push_back( (uint8_t)( v >> 8 ) );
+	out.push_back( (uint8_t)v );
+}
+
+inline void png_chunk( std::vector<uint8_t> &out, const char *type, const uint8_t *data, size_t length )
+{
+	png_put32( out, (uint32_t)length );
+	size_t start = out.size();
+	out.insert( out.end(), type, type + 4 );
+	out.insert( out.end(), data, data + length );
+	png_put32( out, png_crc32( &out[start], length + 4 ) );
+}
+
+/// <summary> Encodes top-down RGBA pixels (4 bytes per pixel) as a complete .png file in memory. </summary>
+inline std::vector<uint8_t> png_encode( uint32_t width, uint32_t height, const uint8_t *dataRGBA )
+{
+	// scanlines with a filter byte of 0 in front
+	size_t stride = (size_t)width * 4;
+	std::vector<uint8_t> raw( ( stride + 1 ) * height );
+	for ( uint32_t y = 0; y < height; y++ )
+	{
+		raw[y * ( stride + 1 )] = 0;
+		memcpy( &raw[y * ( stride + 1 ) + 1], dataRGBA + y * stride, stride );
+	}
+
+	// zlib stream of stored blocks
+	std::vector<uint8_t> zlib;
+	zlib.reserve( raw.size() + raw.size() / 65535 * 5 + 16 );
+	zlib.push_back( 0x78 );
+	zlib.push_back( 0x01 );
+
+	size_t offset = 0;
+	do
+	{
+		size_t length = std::min( raw.size() - offset, (size_t)65535 );
+		bool bLast = offset + length == raw.size();
+		zlib.push_back( bLast ? 1 : 0 );
+		zlib.push_back( (uint8_t)length );
+		zlib.push_back( (uint8_t)( length >> 8 ) );
+		zlib.push_back( (uint8_t)~length );
+		zlib.push_back( (uint8_t)( ~length >> 8 ) );
+		zlib.insert( zlib.end(), raw.begin() + offset, raw.begin() + offset + length );
+		offset += length;
+	} while ( offset < raw.size() );
+
+	uint32_t a = 1, b = 0;
+	for ( size_t i = 0; i < raw.size(); i++ )
+	{
+		a = ( a + raw[i] ) % 65521;
+		b = ( b + a ) % 65521;
+	}
+	png_put32( zlib, ( b << 16 ) | a );
+
+	std::vector<uint8_t> out;
+	const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	out.insert( out.end(), signature, signature + 8 );
+
+	uint8_t header[13] = {
+		(uint8_t)( width >> 24 ), (uint8_t)( width >> 16 ), (uint8_t)( width >> 8 ), (uint8_t)width,
+		(uint8_t)( height >> 24 ), (uint8_t)( height >> 16 ), (uint8_t)( height >> 8 ), (uint8_t)height,
+		8,	// bit depth
+		6,	// RGBA
+		0, 0, 0 };
+	png_chunk( out, "IHDR", header, sizeof(header) );
+	png_chunk( out, "IDAT", zlib.data(), zlib.size() );
+	png_chunk( out, "IEND", NULL, 0 );
+
+	return out;
+}
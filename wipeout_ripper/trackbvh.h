@@ -0,0 +1,604 @@
+//
+// Bounding volume hierarchy over the track quads
+// Answers point -> nearest face/section, ray -> first face hit and box -> overlapping faces without
+// walking every face. The batch queries take a parallel for, so callers can spread them over their
+// own threads. The ripper builds the tree once per track and saves it next to the ripped track for
+// other tools to load. The file is a raw dump in host byte order with a tag to reject foreign ones.
+//
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+#include <vector>
+
+#include "wipeout_definitions.h"
+
+// faces per leaf
+#define BVH_LEAF_SIZE 4
+#define BVH_VERSION 1
+// the traversal stack holds at most one node per level plus one, so this also caps the depth
+#define BVH_STACK_SIZE 64
+// the batch queries hand out the points in chunks of this many
+#define BVH_QUERY_CHUNK 1024
+
+// the default for the batch queries, runs fn( i ) for every i in [0, count) on the calling thread
+struct BVHSerialFor
+{
+	template <class Fn>
+	void operator()( size_t count, Fn fn ) const
+	{
+		for ( size_t i = 0; i < count; i++ )
+			fn( i );
+	}
+};
+
+struct BVHBox
+{
+	float lo[3];
+	float hi[3];
+
+	void clear()
+	{
+		for ( int k = 0; k < 3; k++ )
+		{
+			lo[k] = FLT_MAX;
+			hi[k] = -FLT_MAX;
+		}
+	}
+
+	void add( const float *p )
+	{
+		for ( int k = 0; k < 3; k++ )
+		{
+			lo[k] = std::min( lo[k], p[k] );
+			hi[k] = std::max( hi[k], p[k] );
+		}
+	}
+
+	void add( const BVHBox &box )
+	{
+		add( box.lo );
+		add( box.hi );
+	}
+
+	bool overlaps( const BVHBox &box ) const
+	{
+		for ( int k = 0; k < 3; k++ )
+		{
+			if ( lo[k] > box.hi[k] || hi[k] < box.lo[k] )
+				return false;
+		}
+		return true;
+	}
+
+	float distanceSquared( const float *p ) const
+	{
+		float d = 0;
+		for ( int k = 0; k < 3; k++ )
+		{
+			float e = std::max( std::max( lo[k] - p[k], p[k] - hi[k] ), 0.0f );
+			d += e * e;
+		}
+		return d;
+	}
+
+	// slab test, true when the ray enters the box before maxT
+	bool intersectRay( const float *origin, const float *inverseDirection, float maxT ) const
+	{
+		float tmin = 0, tmax = maxT;
+		for ( int k = 0; k < 3; k++ )
+		{
+			float t0 = ( lo[k] - origin[k] ) * inverseDirection[k];
+			float t1 = ( hi[k] - origin[k] ) * inverseDirection[k];
+			if ( t0 > t1 )
+				std::swap( t0, t1 );
+			tmin = std::max( tmin, t0 );
+			tmax = std::min( tmax, t1 );
+			if ( tmin > tmax )
+				return false;
+		}
+		return true;
+	}
+};
+
+struct BVHNode
+{
+	BVHBox	 box;
+	uint32_t first;	// leaf: first entry in TrackBVH::faces, otherwise the left child, the right one follows it
+	uint32_t count;	// faces in the leaf, 0 for inner nodes
+};
+
+inline float bvh_dot( const float *a, const float *b )
+{
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+inline void bvh_sub( float *out, const float *a, const float *b )
+{
+	out[0] = a[0] - b[0];
+	out[1] = a[1] - b[1];
+	out[2] = a[2] - b[2];
+}
+
+inline void bvh_cross( float *out, const float *a, const float *b )
+{
+	out[0] = a[1] * b[2] - a[2] * b[1];
+	out[1] = a[2] * b[0] - a[0] * b[2];
+	out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+// squared distance from p to the triangle abc, Ericson's closest point in triangle
+inline float bvh_triangleDistanceSquared( const float *p, const float *a, const float *b, const float *c )
+{
+	float ab[3], ac[3], ap[3], closest[3];
+	bvh_sub( ab, b, a );
+	bvh_sub( ac, c, a );
+	bvh_sub( ap, p, a );
+
+	float d1 = bvh_dot( ab, ap ), d2 = bvh_dot( ac, ap );
+	float v = 0, w = 0;
+
+	float bp[3], cp[3];
+	bvh_sub( bp, p, b );
+	bvh_sub( cp, p, c );
+	float d3 = bvh_dot( ab, bp ), d4 = bvh_dot( ac, bp );
+	float d5 = bvh_dot( ab, cp ), d6 = bvh_dot( ac, cp );
+	float va = d3 * d6 - d5 * d4, vb = d5 * d2 - d1 * d6, vc = d1 * d4 - d3 * d2;
+
+	if ( d1 <= 0 && d2 <= 0 )
+		v = w = 0;										// a
+	else if ( d3 >= 0 && d4 <= d3 )
+		v = 1, w = 0;									// b
+	else if ( d6 >= 0 && d5 <= d6 )
+		v = 0, w = 1;									// c
+	else if ( vc <= 0 && d1 >= 0 && d3 <= 0 )
+		v = d1 / ( d1 - d3 ), w = 0;					// ab
+	else if ( vb <= 0 && d2 >= 0 && d6 <= 0 )
+		v = 0, w = d2 / ( d2 - d6 );					// ac
+	else if ( va <= 0 && ( d4 - d3 ) >= 0 && ( d5 - d6 ) >= 0 )
+	{
+		w = ( d4 - d3 ) / ( ( d4 - d3 ) + ( d5 - d6 ) );	// bc
+		v = 1 - w;
+	}
+	else
+	{
+		float denom = 1 / ( va + vb + vc );
+		v = vb * denom;
+		w = vc * denom;
+	}
+
+	for ( int k = 0; k < 3; k++ )
+		closest[k] = a[k] + ab[k] * v + ac[k] * w;
+
+	float d[3];
+	bvh_sub( d, p, closest );
+	return bvh_dot( d, d );
+}
+
+// Moller-Trumbore, both sides count as a hit
+inline bool bvh_rayTriangle( const float *origin, const float *direction, const float *a, const float *b, const float *c, float &t )
+{
+	float ab[3], ac[3], pvec[3], tvec[3], qvec[3];
+	bvh_sub( ab, b, a );
+	bvh_sub( ac, c, a );
+	bvh_cross( pvec, direction, ac );
+
+	float det = bvh_dot( ab, pvec );
+	if ( fabsf( det ) < 1e-12f )
+		return false;
+
+	float inverse = 1 / det;
+	bvh_sub( tvec, origin, a );
+	float u = bvh_dot( tvec, pvec ) * inverse;
+	if ( u < 0 || u > 1 )
+		return false;
+
+	bvh_cross( qvec, tvec, ab );
+	float v = bvh_dot( direction, qvec ) * inverse;
+	if ( v < 0 || u + v > 1 )
+		return false;
+
+	t = bvh_dot( ac, qvec ) * inverse;
+	return t >= 0;
+}
+
+struct TrackBVH
+{
+	std::vector<BVHNode>  nodes;		// nodes[0] is the root
+	std::vector<uint32_t> faces;		// track face of every entry, in leaf order
+	std::vector<float>	  quads;		// 4 corners (12 floats) per entry
+	std::vector<int32_t>  sections;		// section per entry, -1 when the face is in none
+
+	/// <summary> Builds the tree over every face with valid indices, split at the median of the longest axis. </summary>
+	void build( const Track &theTrack )
+	{
+		nodes.clear();
+		faces.clear();
+		quads.clear();
+		sections.clear();
+
+		std::vector<int32_t> sectionOf( theTrack.faces.size(), -1 );
+		for ( size_t s = 0; s < theTrack.sections.size(); s++ )
+		{
+			size_t last = std::min( (size_t)theTrack.sections[s].firstFace + theTrack.sections[s].numFaces, theTrack.faces.size() );
+			for ( size_t i = theTrack.sections[s].firstFace; i < last; i++ )
+				sectionOf[i] = (int32_t)s;
+		}
+
+		std::vector<uint32_t> entries;
+		std::vector<float> corners, centers;
+		for ( size_t i = 0; i < theTrack.faces.size(); i++ )
+		{
+			const TrackFace &face = theTrack.faces[i];
+			float quad[12];
+			bool bValid = true;
+			for ( int k = 0; k < 4 && bValid; k++ )
+			{
+				int index = face.indices[k];
+				bValid = index >= 0 && index < (int)theTrack.vertices.size();
+				if ( bValid )
+				{
+					quad[k * 3] = (float)theTrack.vertices[index].x;
+					quad[k * 3 + 1] = (float)theTrack.vertices[index].y;
+					quad[k * 3 + 2] = (float)theTrack.vertices[index].z;
+				}
+			}
+			if ( !bValid )
+				continue;
+
+			entries.push_back( (uint32_t)entries.size() );
+			faces.push_back( (uint32_t)i );
+			sections.push_back( sectionOf[i] );
+			corners.insert( corners.end(), quad, quad + 12 );
+			for ( int k = 0; k < 3; k++ )
+				centers.push_back( ( quad[k] + quad[3 + k] + quad[6 + k] + quad[9 + k] ) * 0.25f );
+		}
+
+		if ( entries.empty() )
+			return;
+
+		struct Range
+		{
+			uint32_t node, begin, end;
+		};
+		std::vector<Range> stack;
+
+		nodes.reserve( entries.size() * 2 );
+		nodes.push_back( BVHNode() );
+		stack.push_back( { 0, 0, (uint32_t)entries.size() } );
+
+		while ( !stack.empty() )
+		{
+			Range range = stack.back();
+			stack.pop_back();
+
+			BVHBox box, centerBox;
+			box.clear();
+			centerBox.clear();
+			for ( uint32_t i = range.begin; i < range.end; i++ )
+			{
+				for ( int k = 0; k < 4; k++ )
+					box.add( &corners[entries[i] * 12 + k * 3] );
+				centerBox.add( &centers[entries[i] * 3] );
+			}
+			nodes[range.node].box = box;
+
+			int axis = 0;
+			for ( int k = 1; k < 3; k++ )
+			{
+				if ( centerBox.hi[k] - centerBox.lo[k] > centerBox.hi[axis] - centerBox.lo[axis] )
+					axis = k;
+			}
+
+			uint32_t count = range.end - range.begin;
+			if ( count <= BVH_LEAF_SIZE || centerBox.hi[axis] <= centerBox.lo[axis] )
+			{
+				nodes[range.node].first = range.begin;
+				nodes[range.node].count = count;
+				continue;
+			}
+
+			uint32_t middle = range.begin + count / 2;
+			std::nth_element( entries.begin() + range.begin, entries.begin() + middle, entries.begin() + range.end, [&]( uint32_t a, uint32_t b )
+			{
+				return centers[a * 3 + axis] < centers[b * 3 + axis];
+			} );
+
+			uint32_t left = (uint32_t)nodes.size();
+			nodes[range.node].first = left;
+			nodes[range.node].count = 0;
+			nodes.push_back( BVHNode() );
+			nodes.push_back( BVHNode() );
+			stack.push_back( { left, range.begin, middle } );
+			stack.push_back( { left + 1, middle, range.end } );
+		}
+
+		// entries into leaf order, so a leaf reads one contiguous run
+		std::vector<uint32_t> sortedFaces( entries.size() );
+		std::vector<int32_t> sortedSections( entries.size() );
+		quads.resize( entries.size() * 12 );
+		for ( size_t i = 0; i < entries.size(); i++ )
+		{
+			sortedFaces[i] = faces[entries[i]];
+			sortedSections[i] = sections[entries[i]];
+			memcpy( &quads[i * 12], &corners[entries[i] * 12], 12 * sizeof(float) );
+		}
+		faces.swap( sortedFaces );
+		sections.swap( sortedSections );
+	}
+
+	float quadDistanceSquared( uint32_t entry, const float *point ) const
+	{
+		const float *q = &quads[entry * 12];
+		return std::min( bvh_triangleDistanceSquared( point, q, q + 3, q + 6 ), bvh_triangleDistanceSquared( point, q, q + 6, q + 9 ) );
+	}
+
+	/// <summary> Entry of the face closest to the point, -1 for an empty tree. </summary>
+	int32_t nearestEntry( const float *point, float *distanceSquared = NULL ) const
+	{
+		int32_t best = -1;
+		float bestDistance = FLT_MAX;
+		if ( nodes.empty() )
+			return best;
+
+		uint32_t stack[BVH_STACK_SIZE];
+		int top = 0;
+		stack[top++] = 0;
+
+		while ( top )
+		{
+			const BVHNode &node = nodes[stack[--top]];
+			if ( node.box.distanceSquared( point ) >= bestDistance )
+				continue;
+
+			if ( node.count )
+			{
+				for ( uint32_t i = node.first; i < node.first + node.count; i++ )
+				{
+					float d = quadDistanceSquared( i, point );
+					if ( d < bestDistance )
+					{
+						bestDistance = d;
+						best = (int32_t)i;
+					}
+				}
+				continue;
+			}
+
+			// the closer child goes on top
+			float left = nodes[node.first].box.distanceSquared( point );
+			float right = nodes[node.first + 1].box.distanceSquared( point );
+			stack[top++] = left < right ? node.first + 1 : node.first;
+			stack[top++] = left < right ? node.first : node.first + 1;
+		}
+
+		if ( distanceSquared )
+			*distanceSquared = bestDistance;
+		return best;
+	}
+
+	/// <summary> Track face closest to the point, -1 for an empty tree. </summary>
+	int32_t nearestFace( const float *point ) const
+	{
+		int32_t entry = nearestEntry( point );
+		return entry < 0 ? -1 : (int32_t)faces[entry];
+	}
+
+	/// <summary> Section of the face closest to the point, -1 when there is none. </summary>
+	int32_t nearestSection( const float *point ) const
+	{
+		int32_t entry = nearestEntry( point );
+		return entry < 0 ? -1 : sections[entry];
+	}
+
+	/// <summary> First track face the ray hits before maxT (in units of direction), -1 on a miss. </summary>
+	int32_t raycast( const float *origin, const float *direction, float &t, float maxT = FLT_MAX ) const
+	{
+		int32_t hit = -1;
+		t = maxT;
+		if ( nodes.empty() )
+			return hit;
+
+		float inverseDirection[3];
+		for ( int k = 0; k < 3; k++ )
+			inverseDirection[k] = direction[k] != 0 ? 1 / direction[k] : FLT_MAX;
+
+		uint32_t stack[BVH_STACK_SIZE];
+		int top = 0;
+		stack[top++] = 0;
+
+		while ( top )
+		{
+			const BVHNode &node = nodes[stack[--top]];
+			if ( !node.box.intersectRay( origin, inverseDirection, t ) )
+				continue;
+
+			if ( node.count )
+			{
+				for ( uint32_t i = node.first; i < node.first + node.count; i++ )
+				{
+					const float *q = &quads[i * 12];
+					float ht;
+					if ( ( bvh_rayTriangle( origin, direction, q, q + 3, q + 6, ht ) && ht < t )
+						|| ( bvh_rayTriangle( origin, direction, q, q + 6, q + 9, ht ) && ht < t ) )
+					{
+						t = ht;
+						hit = (int32_t)faces[i];
+					}
+				}
+				continue;
+			}
+
+			stack[top++] = node.first + 1;
+			stack[top++] = node.first;
+		}
+
+		return hit;
+	}
+
+	/// <summary> Appends the track faces whose bounds overlap the box. </summary>
+	void overlap( const BVHBox &box, std::vector<uint32_t> &result ) const
+	{
+		if ( nodes.empty() )
+			return;
+
+		uint32_t stack[BVH_STACK_SIZE];
+		int top = 0;
+		stack[top++] = 0;
+
+		while ( top )
+		{
+			const BVHNode &node = nodes[stack[--top]];
+			if ( !node.box.overlaps( box ) )
+				continue;
+
+			if ( node.count )
+			{
+				for ( uint32_t i = node.first; i < node.first + node.count; i++ )
+				{
+					BVHBox faceBox;
+					faceBox.clear();
+					for ( int k = 0; k < 4; k++ )
+						faceBox.add( &quads[i * 12 + k * 3] );
+					if ( faceBox.overlaps( box ) )
+						result.push_back( faces[i] );
+				}
+				continue;
+			}
+
+			stack[top++] = node.first + 1;
+			stack[top++] = node.first;
+		}
+	}
+
+	/// <summary> nearestSection for every point, parallelFor( count, fn ) may run fn on any thread. </summary>
+	template <class ParallelFor = BVHSerialFor>
+	void nearestSections( const std::vector<Vectorf> &points, std::vector<int32_t> &result, ParallelFor parallelFor = ParallelFor() ) const
+	{
+		result.resize( points.size() );
+		parallelFor( ( points.size() + BVH_QUERY_CHUNK - 1 ) / BVH_QUERY_CHUNK, [&]( size_t chunk )
+		{
+			size_t last = std::min( ( chunk + 1 ) * BVH_QUERY_CHUNK, points.size() );
+			for ( size_t i = chunk * BVH_QUERY_CHUNK; i < last; i++ )
+				result[i] = nearestSection( &points[i].x );
+		} );
+	}
+
+	/// <summary> raycast for every origin and direction pair, distances gets the t of every hit. </summary>
+	template <class ParallelFor = BVHSerialFor>
+	void raycasts( const std::vector<Vectorf> &origins, const std::vector<Vectorf> &directions, std::vector<int32_t> &result, std::vector<float> &distances, ParallelFor parallelFor = ParallelFor() ) const
+	{
+		size_t count = std::min( origins.size(), directions.size() );
+		result.resize( count );
+		distances.resize( count );
+		parallelFor( ( count + BVH_QUERY_CHUNK - 1 ) / BVH_QUERY_CHUNK, [&]( size_t chunk )
+		{
+			size_t last = std::min( ( chunk + 1 ) * BVH_QUERY_CHUNK, count );
+			for ( size_t i = chunk * BVH_QUERY_CHUNK; i < last; i++ )
+				result[i] = raycast( &origins[i].x, &directions[i].x, distances[i] );
+		} );
+	}
+
+	/// <summary> overlap for every box, each box gets its own list of track faces. </summary>
+	template <class ParallelFor = BVHSerialFor>
+	void overlaps( const std::vector<BVHBox> &boxes, std::vector<std::vector<uint32_t>> &result, ParallelFor parallelFor = ParallelFor() ) const
+	{
+		result.assign( boxes.size(), std::vector<uint32_t>() );
+		parallelFor( ( boxes.size() + BVH_QUERY_CHUNK - 1 ) / BVH_QUERY_CHUNK, [&]( size_t chunk )
+		{
+			size_t last = std::min( ( chunk + 1 ) * BVH_QUERY_CHUNK, boxes.size() );
+			for ( size_t i = chunk * BVH_QUERY_CHUNK; i < last; i++ )
+				overlap( boxes[i], result[i] );
+		} );
+	}
+
+	// every child and leaf range in bounds and no deeper than the traversal stack, children always come
+	// after their parent when built so that is required too, it rules out cycles
+	bool valid() const
+	{
+		std::vector<uint32_t> depth( nodes.size(), 0 );
+		for ( size_t i = 0; i < nodes.size(); i++ )
+		{
+			const BVHNode &node = nodes[i];
+			if ( node.count )
+			{
+				if ( (uint64_t)node.first + node.count > faces.size() )
+					return false;
+				continue;
+			}
+
+			if ( node.first <= i || (uint64_t)node.first + 1 >= nodes.size() || depth[i] + 2 > BVH_STACK_SIZE )
+				return false;
+			depth[node.first] = std::max( depth[node.first], depth[i] + 1 );
+			depth[node.first + 1] = std::max( depth[node.first + 1], depth[i] + 1 );
+		}
+		return true;
+	}
+
+	// "TBVH" | u32 version | u32 0x01020304 | u32 node count | u32 entry count | nodes | faces | quads | sections
+	bool save( const char *filename ) const
+	{
+		FILE *fp = NULL;
+#ifdef _MSC_VER
+		fopen_s( &fp, filename, "wb" );
+#else
+		fp = fopen( filename, "wb" );
+#endif
+		if ( fp == NULL )
+			return false;
+
+		const uint32_t header[5] = { 0x48564254, BVH_VERSION, 0x01020304, (uint32_t)nodes.size(), (uint32_t)faces.size() };
+		fwrite( header, sizeof(header), 1, fp );
+		fwrite( nodes.data(), sizeof(BVHNode), nodes.size(), fp );
+		fwrite( faces.data(), sizeof(uint32_t), faces.size(), fp );
+		fwrite( quads.data(), sizeof(float), quads.size(), fp );
+		fwrite( sections.data(), sizeof(int32_t), sections.size(), fp );
+		fclose( fp );
+
+		return true;
+	}
+
+	bool load( const char *filename )
+	{
+		FILE *fp = NULL;
+#ifdef _MSC_VER
+		fopen_s( &fp, filename, "rb" );
+#else
+		fp = fopen( filename, "rb" );
+#endif
+		if ( fp == NULL )
+			return false;
+
+		uint32_t header[5];
+		bool bOk = fread( header, sizeof(header), 1, fp ) == 1
+			&& header[0] == 0x48564254 && header[1] == BVH_VERSION && header[2] == 0x01020304;
+
+		if ( bOk )
+		{
+			nodes.resize( header[3] );
+			faces.resize( header[4] );
+			quads.resize( header[4] * 12 );
+			sections.resize( header[4] );
+			bOk = fread( nodes.data(), sizeof(BVHNode), nodes.size(), fp ) == nodes.size()
+				&& fread( faces.data(), sizeof(uint32_t), faces.size(), fp ) == faces.size()
+				&& fread( quads.data(), sizeof(float), quads.size(), fp ) == quads.size()
+				&& fread( sections.data(), sizeof(int32_t), sections.size(), fp ) == sections.size();
+		}
+		fclose( fp );
+
+		bOk = bOk && valid();
+		if ( !bOk )
+		{
+			nodes.clear();
+			faces.clear();
+			quads.clear();
+			sections.clear();
+		}
+		return bOk;
+	}
+};
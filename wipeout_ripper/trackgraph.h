@@ -0,0 +1,468 @@
+//
+// Centreline graph of the track sections
+// The sections are split into routes: route 0 follows next from section 0 (the main loop), every
+// nextJunction that leads off to sections no route has reached yet starts a new route, which then
+// follows next until it runs back into a known section. Each section stores its arc length along
+// its route, so distance -> position/section is a binary search and section -> distance a lookup.
+// A position goes back to a distance through a grid over the section positions: the nearest
+// section is found in the cells around the position, then the position is projected onto the
+// segments into and out of that section.
+// Saved as a raw dump in host byte order with a tag to reject foreign ones, like the bvh.
+//
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+#include <vector>
+
+#include "wipeout_definitions.h"
+
+#define GRAPH_VERSION 1
+
+struct TrackGraphNode
+{
+	float	 position[3];
+	int32_t	 next;			// -1 when there is none
+	int32_t	 previous;
+	int32_t	 junction;		// nextJunction
+	uint32_t flags;			// TrackSectionFlags
+	int32_t	 route;			// -1 when no route reaches the section
+	float	 distance;		// arc length from the first section of its route
+};
+
+struct TrackRoute
+{
+	std::vector<int32_t> sections;
+	std::vector<float>	 distances;	// arc length at every section, the same as TrackGraphNode::distance
+	float				 length;	// including the segment into end
+	bool				 bClosed;	// loops back to its own first section
+	int32_t				 start;		// section it branches off from, -1 for the main loop
+	int32_t				 end;		// section it runs into after the last one, -1 for a dead end
+};
+
+// uniform grid over the section positions in x/z, the height only counts in the distances
+struct SectionGrid
+{
+	float				  origin[2];
+	float				  cellSize;
+	int					  columns;
+	int					  rows;
+	std::vector<uint32_t> cellStart;	// sections of cell c are sections[cellStart[c]] up to cellStart[c + 1]
+	std::vector<int32_t>  sections;
+	std::vector<Vectorf>  positions;
+
+	void build( const std::vector<Vectorf> &sectionPositions )
+	{
+		positions = sectionPositions;
+		size_t count = positions.size();
+
+		float lo[2] = { FLT_MAX, FLT_MAX }, hi[2] = { -FLT_MAX, -FLT_MAX };
+		for ( size_t s = 0; s < count; s++ )
+		{
+			lo[0] = std::min( lo[0], positions[s].x );
+			lo[1] = std::min( lo[1], positions[s].z );
+			hi[0] = std::max( hi[0], positions[s].x );
+			hi[1] = std::max( hi[1], positions[s].z );
+		}
+
+		// around one section per cell along a track that is mostly a line
+		float extent = count ? std::max( hi[0] - lo[0], hi[1] - lo[1] ) : 0;
+		cellSize = std::max( extent / std::max( sqrtf( (float)count ), 1.0f ), 1.0f );
+		origin[0] = count ? lo[0] : 0;
+		origin[1] = count ? lo[1] : 0;
+		columns = count ? std::min( (int)( ( hi[0] - lo[0] ) / cellSize ) + 1, 1024 ) : 1;
+		rows = count ? std::min( (int)( ( hi[1] - lo[1] ) / cellSize ) + 1, 1024 ) : 1;
+
+		// counting sort of the sections by cell
+		std::vector<int> cells( count );
+		cellStart.assign( columns * rows + 1, 0 );
+		for ( size_t s = 0; s < count; s++ )
+		{
+			cells[s] = cell( column( positions[s].x ), row( positions[s].z ) );
+			cellStart[cells[s] + 1]++;
+		}
+		for ( size_t c = 0; c + 1 < cellStart.size(); c++ )
+			cellStart[c + 1] += cellStart[c];
+
+		sections.resize( count );
+		std::vector<uint32_t> fill( cellStart.begin(), cellStart.end() - 1 );
+		for ( size_t s = 0; s < count; s++ )
+			sections[fill[cells[s]]++] = (int32_t)s;
+	}
+
+	int column( float x ) const { return std::min( std::max( (int)floorf( ( x - origin[0] ) / cellSize ), 0 ), columns - 1 ); }
+	int row( float z ) const { return std::min( std::max( (int)floorf( ( z - origin[1] ) / cellSize ), 0 ), rows - 1 ); }
+	int cell( int c, int r ) const { return r * columns + c; }
+
+	float distanceSquared( int32_t section, const float *p ) const
+	{
+		float d[3] = { positions[section].x - p[0], positions[section].y - p[1], positions[section].z - p[2] };
+		return d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+	}
+
+	/// <summary> Section whose position is closest to p, -1 when there are none. </summary>
+	int32_t nearest( const float *p ) const
+	{
+		int32_t best = -1;
+		float bestDistance = FLT_MAX;
+		int c0 = column( p[0] ), r0 = row( p[2] );
+
+		// rings of cells around p, nothing past ring n is nearer than n - 1 cells
+		for ( int ring = 0; ring <= std::max( columns, rows ); ring++ )
+		{
+			float reach = ( ring - 1 ) * cellSize;
+			if ( best >= 0 && reach > 0 && reach * reach > bestDistance )
+				break;
+
+			for ( int r = r0 - ring; r <= r0 + ring; r++ )
+			{
+				if ( r < 0 || r >= rows )
+					continue;
+
+				// the full row at the ring's top and bottom, only both ends in between
+				int step = ( r == r0 - ring || r == r0 + ring ) ? 1 : std::max( ring * 2, 1 );
+				for ( int c = c0 - ring; c <= c0 + ring; c += step )
+				{
+					if ( c < 0 || c >= columns )
+						continue;
+
+					int index = cell( c, r );
+					for ( uint32_t i = cellStart[index]; i < cellStart[index + 1]; i++ )
+					{
+						float distance = distanceSquared( sections[i], p );
+						if ( distance < bestDistance || ( distance == bestDistance && sections[i] < best ) )
+						{
+							bestDistance = distance;
+							best = sections[i];
+						}
+					}
+				}
+			}
+		}
+
+		return best;
+	}
+
+	/// <summary> Sections whose position is inside the x/z rectangle lo to hi. </summary>
+	void gather( const float *lo, const float *hi, std::vector<int32_t> &out ) const
+	{
+		for ( int r = row( lo[2] ); r <= row( hi[2] ); r++ )
+		{
+			for ( int c = column( lo[0] ); c <= column( hi[0] ); c++ )
+			{
+				int index = cell( c, r );
+				for ( uint32_t i = cellStart[index]; i < cellStart[index + 1]; i++ )
+				{
+					const Vectorf &p = positions[sections[i]];
+					if ( p.x >= lo[0] && p.x <= hi[0] && p.z >= lo[2] && p.z <= hi[2] )
+						out.push_back( sections[i] );
+				}
+			}
+		}
+	}
+};
+
+inline float graph_distance( const float *a, const float *b )
+{
+	float dx = b[0] - a[0], dy = b[1] - a[1], dz = b[2] - a[2];
+	return sqrtf( dx * dx + dy * dy + dz * dz );
+}
+
+struct TrackGraph
+{
+	std::vector<TrackGraphNode> nodes;
+	std::vector<TrackRoute>		routes;
+	SectionGrid					grid;	// over the node positions, rebuilt by load
+
+	void build( const Track &theTrack )
+	{
+		nodes.clear();
+		routes.clear();
+		grid = SectionGrid();
+
+		int32_t count = (int32_t)theTrack.sections.size();
+		auto valid = [count]( int32_t section ) { return section >= 0 && section < count ? section : -1; };
+
+		nodes.resize( count );
+		for ( int32_t s = 0; s < count; s++ )
+		{
+			const TrackSection &section = theTrack.sections[s];
+			TrackGraphNode &node = nodes[s];
+			node.position[0] = (float)section.x;
+			node.position[1] = (float)section.y;
+			node.position[2] = (float)section.z;
+			node.next = valid( section.next );
+			node.previous = valid( section.previous );
+			node.junction = valid( section.nextJunction );
+			node.flags = section.flag;
+			node.route = -1;
+			node.distance = 0;
+		}
+
+		if ( count == 0 )
+			return;
+
+		// breadth first over the routes, each may start new ones at its junctions
+		std::vector<std::pair<int32_t, int32_t>> starts;	// first section, branching section
+		starts.push_back( std::make_pair( 0, -1 ) );
+
+		for ( size_t i = 0; i < starts.size(); i++ )
+		{
+			int32_t first = starts[i].first;
+			if ( nodes[first].route >= 0 )
+				continue;
+
+			TrackRoute route;
+			route.start = starts[i].second;
+			route.end = -1;
+			route.bClosed = false;
+			route.length = 0;
+
+			int32_t routeIndex = (int32_t)routes.size();
+			int32_t s = first;
+			while ( true )
+			{
+				TrackGraphNode &node = nodes[s];
+				node.route = routeIndex;
+				node.distance = route.length;
+				route.sections.push_back( s );
+				route.distances.push_back( route.length );
+
+				if ( node.junction >= 0 && nodes[node.junction].route < 0 )
+					starts.push_back( std::make_pair( node.junction, s ) );
+
+				if ( node.next < 0 )
+					break;
+
+				route.length += graph_distance( node.position, nodes[node.next].position );
+				if ( nodes[node.next].route >= 0 )
+				{
+					route.end = node.next;
+					route.bClosed = node.next == first;
+					break;
+				}
+				s = node.next;
+			}
+
+			routes.push_back( route );
+		}
+
+		buildGrid();
+	}
+
+	void buildGrid()
+	{
+		std::vector<Vectorf> positions( nodes.size() );
+		for ( size_t s = 0; s < nodes.size(); s++ )
+			positions[s] = { nodes[s].position[0], nodes[s].position[1], nodes[s].position[2] };
+		grid.build( positions );
+	}
+
+	/// <summary> Arc length of a section along its route, -1 when it is on none. </summary>
+	float distanceOf( int32_t section ) const
+	{
+		if ( section < 0 || section >= (int32_t)nodes.size() || nodes[section].route < 0 )
+			return -1;
+		return nodes[section].distance;
+	}
+
+	/// <summary> Position and section at a distance along a route, closed routes wrap around, open ones clamp. </summary>
+	bool locate( int32_t routeIndex, float distance, float *position, int32_t *section = NULL ) const
+	{
+		if ( routeIndex < 0 || routeIndex >= (int32_t)routes.size() )
+			return false;
+
+		const TrackRoute &route = routes[routeIndex];
+		if ( route.bClosed && route.length > 0 )
+		{
+			distance = fmodf( distance, route.length );
+			if ( distance < 0 )
+				distance += route.length;
+		}
+		distance = std::min( std::max( distance, 0.0f ), route.length );
+
+		size_t i = std::upper_bound( route.distances.begin(), route.distances.end(), distance ) - route.distances.begin() - 1;
+		const float *from = nodes[route.sections[i]].position;
+
+		// the segment after the last section goes into end
+		int32_t to = i + 1 < route.sections.size() ? route.sections[i + 1] : route.end;
+		float segmentEnd = i + 1 < route.sections.size() ? route.distances[i + 1] : route.length;
+		float t = 0;
+		if ( to >= 0 && segmentEnd > route.distances[i] )
+			t = ( distance - route.distances[i] ) / ( segmentEnd - route.distances[i] );
+
+		for ( int k = 0; k < 3; k++ )
+			position[k] = to >= 0 ? from[k] + ( nodes[to].position[k] - from[k] ) * t : from[k];
+		if ( section )
+			*section = route.sections[i];
+		return true;
+	}
+
+	/// <summary> Distance along its route of the closest point of the centreline to position, -1 when no route is near. </summary>
+	float distanceAt( const float *position, int32_t *routeIndex = NULL, int32_t *section = NULL ) const
+	{
+		int32_t nearest = nodes.empty() ? -1 : grid.nearest( position );
+		if ( nearest < 0 || nodes[nearest].route < 0 )
+			return -1;
+
+		const TrackGraphNode &node = nodes[nearest];
+		const TrackRoute &route = routes[node.route];
+		float best = FLT_MAX, distance = node.distance;
+		int32_t bestSection = nearest;
+
+		// the segment from -> to starts at arc length start, only segments of the node's own route count
+		auto project = [&]( int32_t from, int32_t to, float start )
+		{
+			const float *a = nodes[from].position, *b = nodes[to].position;
+			float ab[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+			float ap[3] = { position[0] - a[0], position[1] - a[1], position[2] - a[2] };
+			float lengthSquared = ab[0] * ab[0] + ab[1] * ab[1] + ab[2] * ab[2];
+			float t = lengthSquared > 0 ? std::min( std::max( ( ap[0] * ab[0] + ap[1] * ab[1] + ap[2] * ab[2] ) / lengthSquared, 0.0f ), 1.0f ) : 0;
+
+			float closest[3] = { a[0] + ab[0] * t, a[1] + ab[1] * t, a[2] + ab[2] * t };
+			float d = graph_distance( closest, position );
+			if ( d < best )
+			{
+				best = d;
+				distance = start + sqrtf( lengthSquared ) * t;
+				bestSection = t < 1 || nodes[to].route != node.route ? from : to;
+			}
+		};
+
+		// out of the section, the last one of a route leads into its end
+		if ( node.next >= 0 && ( nodes[node.next].route == node.route || node.next == route.end ) )
+			project( nearest, node.next, node.distance );
+		// into the section
+		if ( node.previous >= 0 && nodes[node.previous].route == node.route && nodes[node.previous].next == nearest )
+			project( node.previous, nearest, nodes[node.previous].distance );
+		if ( best == FLT_MAX )
+			distance = node.distance;
+
+		if ( route.bClosed && route.length > 0 && distance >= route.length )
+			distance -= route.length;
+		if ( routeIndex )
+			*routeIndex = node.route;
+		if ( section )
+			*section = bestSection;
+		return distance;
+	}
+
+	// every section and route reference in bounds, and every route starting at 0 with distances that
+	// never go down, which is what locate's binary search needs
+	bool valid() const
+	{
+		int32_t nodeCount = (int32_t)nodes.size(), routeCount = (int32_t)routes.size();
+		auto section = [nodeCount]( int32_t s ) { return s >= -1 && s < nodeCount; };
+
+		for ( size_t s = 0; s < nodes.size(); s++ )
+		{
+			const TrackGraphNode &node = nodes[s];
+			if ( !section( node.next ) || !section( node.previous ) || !section( node.junction ) || node.route < -1 || node.route >= routeCount )
+				return false;
+		}
+
+		for ( size_t r = 0; r < routes.size(); r++ )
+		{
+			const TrackRoute &route = routes[r];
+			if ( route.sections.empty() || !section( route.start ) || !section( route.end ) || route.distances[0] != 0 )
+				return false;
+			for ( size_t i = 0; i < route.sections.size(); i++ )
+			{
+				if ( route.sections[i] < 0 || route.sections[i] >= nodeCount || ( i && !( route.distances[i] >= route.distances[i - 1] ) ) )
+					return false;
+			}
+			if ( !( route.length >= route.distances.back() ) )
+				return false;
+		}
+		return true;
+	}
+
+	// "TGRF" | u32 version | u32 0x01020304 | u32 node count | u32 route count | nodes
+	// | per route: u32 section count, f32 length, i32 closed, i32 start, i32 end, sections, distances
+	bool save( const char *filename ) const
+	{
+		FILE *fp = NULL;
+#ifdef _MSC_VER
+		fopen_s( &fp, filename, "wb" );
+#else
+		fp = fopen( filename, "wb" );
+#endif
+		if ( fp == NULL )
+			return false;
+
+		const uint32_t header[5] = { 0x46524754, GRAPH_VERSION, 0x01020304, (uint32_t)nodes.size(), (uint32_t)routes.size() };
+		fwrite( header, sizeof(header), 1, fp );
+		fwrite( nodes.data(), sizeof(TrackGraphNode), nodes.size(), fp );
+
+		for ( size_t r = 0; r < routes.size(); r++ )
+		{
+			const TrackRoute &route = routes[r];
+			uint32_t sectionCount = (uint32_t)route.sections.size();
+			int32_t closed = route.bClosed ? 1 : 0;
+			fwrite( &sectionCount, 4, 1, fp );
+			fwrite( &route.length, 4, 1, fp );
+			fwrite( &closed, 4, 1, fp );
+			fwrite( &route.start, 4, 1, fp );
+			fwrite( &route.end, 4, 1, fp );
+			fwrite( route.sections.data(), sizeof(int32_t), sectionCount, fp );
+			fwrite( route.distances.data(), sizeof(float), sectionCount, fp );
+		}
+		fclose( fp );
+
+		return true;
+	}
+
+	bool load( const char *filename )
+	{
+		FILE *fp = NULL;
+#ifdef _MSC_VER
+		fopen_s( &fp, filename, "rb" );
+#else
+		fp = fopen( filename, "rb" );
+#endif
+		if ( fp == NULL )
+			return false;
+
+		uint32_t header[5];
+		bool bOk = fread( header, sizeof(header), 1, fp ) == 1
+			&& header[0] == 0x46524754 && header[1] == GRAPH_VERSION && header[2] == 0x01020304;
+
+		if ( bOk )
+		{
+			nodes.resize( header[3] );
+			routes.resize( header[4] );
+			bOk = fread( nodes.data(), sizeof(TrackGraphNode), nodes.size(), fp ) == nodes.size();
+		}
+
+		for ( size_t r = 0; r < routes.size() && bOk; r++ )
+		{
+			TrackRoute &route = routes[r];
+			uint32_t sectionCount = 0;
+			int32_t closed = 0;
+			bOk = fread( &sectionCount, 4, 1, fp ) == 1 && fread( &route.length, 4, 1, fp ) == 1 && fread( &closed, 4, 1, fp ) == 1
+				&& fread( &route.start, 4, 1, fp ) == 1 && fread( &route.end, 4, 1, fp ) == 1 && sectionCount <= nodes.size();
+			if ( !bOk )
+				break;
+
+			route.bClosed = closed != 0;
+			route.sections.resize( sectionCount );
+			route.distances.resize( sectionCount );
+			bOk = fread( route.sections.data(), sizeof(int32_t), sectionCount, fp ) == sectionCount
+				&& fread( route.distances.data(), sizeof(float), sectionCount, fp ) == sectionCount;
+		}
+		fclose( fp );
+
+		bOk = bOk && valid();
+		if ( !bOk )
+		{
+			nodes.clear();
+			routes.clear();
+		}
+		buildGrid();
+		return bOk;
+	}
+};
@@ -323,6 +323,14 @@ struct Vector2
 	float v;
 };
 
+struct UVTransform
+{
+	// u' = u / width, v' = 1 - v / height, divided rather than scaled by a reciprocal so the
+	// texcoords stay bit-equal to the ones written before the table existed
+	float width;
+	float height;
+};
+
 struct PolygonBase
 {
 	PolygonType type;
@@ -340,12 +348,34 @@ struct PolygonBase
 };
 
 
+// world space box and sphere, the sphere is centred on the box
+struct Bounds
+{
+	float lo[3];
+	float hi[3];
+	float center[3];
+	float radius;	// -1 when empty
+};
+
 struct Object
 {
 	ObjectHeader header;
 	std::vector<Vertex32> vertices;
 	std::vector<PolygonBase> polygons;
 	int byteLength;
+	int index; // position in the .PRM file
+	Bounds bounds; // of the vertices moved to header.position
+};
+
+// what a .PRM pre-scan knows about an object without parsing it
+struct ObjectIndexEntry
+{
+	std::string name;
+	size_t		offset;
+	size_t		byteLength;
+	uint16_t	vertexCount;
+	uint16_t	polygonCount;
+	Vector3		position;
 };
 
 struct Image
@@ -363,4 +393,30 @@ struct Track
 	std::vector<TrackTextureIndex> textureIndex;
 	std::vector<TrackSection> sections;
 	std::vector<Image> images;
-};
\ No newline at end of file
+	std::vector<Image> mediumImages;	// 2x2 mediumest tiles per texture, laid out as a top-down atlas
+	std::vector<Image> farImages;		// the farthest tile per texture
+	std::vector<Bounds> sectionBounds;	// of the vertices of each section's faces
+};
+
+// export mesh, the polygons flattened to triangles with everything a vertex needs in one place
+struct MeshVertex
+{
+	float	position[3];
+	float	uv[2];		// origin at the top left, like gltf
+	uint8_t color[4];
+};
+
+struct MeshPrimitive
+{
+	int					  texture;	// -1 when untextured
+	std::vector<uint32_t> indices;
+};
+
+struct Mesh
+{
+	std::string				   name;
+	Vectorf					   translation;
+	std::vector<MeshVertex>	   vertices;
+	std::vector<MeshPrimitive> primitives;
+	std::vector<uint32_t>	   objectIds;	// per vertex in static batches, empty everywhere else
+};
@@ -0,0 +1,415 @@
+//
+// Big endian -> little endian conversion of the on-disk structs
+// A record is described by a byte permutation, whole arrays are then shuffled
+// 16 bytes at a time with pshufb (x86) or tbl (arm64), with a scalar fallback.
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <initializer_list>
+#include <type_traits>
+#include <utility>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define ENDIAN_SSSE3 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// msvc allows any intrinsic without /arch, the cpu is checked at runtime instead
+#define ENDIAN_TARGET_SSSE3
+#else
+#define ENDIAN_TARGET_SSSE3 __attribute__((target("ssse3")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define ENDIAN_NEON 1
+#include <arm_neon.h>
+#endif
+
+// a run of big endian values inside a record
+struct SwapField
+{
+	size_t offset;
+	size_t width; // bytes per value, 1 = left as is
+	size_t count;
+};
+
+struct SwapPattern
+{
+	size_t				 recordSize;
+	std::vector<uint8_t> perm;		// byte i of a record is taken from byte perm[i], so records are <= 256 bytes
+	size_t				 blockSize; // smallest multiple of both the record size and 16
+	std::vector<uint8_t> masks;		// one 16 byte shuffle mask per chunk of a block
+	bool				 simd;		// false if a value straddles two 16 byte chunks
+};
+
+SwapPattern makeSwapPattern( size_t recordSize, std::initializer_list<SwapField> fields )
+{
+	SwapPattern pattern;
+	pattern.recordSize = recordSize;
+	pattern.perm.resize( recordSize );
+
+	for ( size_t i = 0; i < recordSize; i++ )
+		pattern.perm[i] = (uint8_t)i;
+
+	for ( const SwapField &field : fields )
+	{
+		for ( size_t c = 0; c < field.count; c++ )
+		{
+			size_t start = field.offset + c * field.width;
+			for ( size_t b = 0; b < field.width; b++ )
+				pattern.perm[start + b] = (uint8_t)( start + field.width - 1 - b );
+		}
+	}
+
+	size_t blockSize = recordSize;
+	while ( blockSize % 16 )
+		blockSize += recordSize;
+
+	pattern.blockSize = blockSize;
+	pattern.masks.resize( blockSize );
+	pattern.simd = true;
+
+	for ( size_t i = 0; i < blockSize; i++ )
+	{
+		size_t record = i / recordSize;
+		size_t source = record * recordSize + pattern.perm[i % recordSize];
+
+		if ( source / 16 != i / 16 )
+			pattern.simd = false;
+
+		pattern.masks[i] = (uint8_t)( source % 16 );
+	}
+
+	return pattern;
+}
+
+#if ENDIAN_SSSE3
+bool cpuHasSSSE3()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid( info, 1 );
+	return ( info[2] & ( 1 << 9 ) ) != 0;
+#else
+	return __builtin_cpu_supports( "ssse3" );
+#endif
+}
+
+ENDIAN_TARGET_SSSE3
+size_t endswapBlocksSSSE3( uint8_t *dst, const uint8_t *src, size_t size, const SwapPattern &pattern )
+{
+	size_t offset = 0;
+	for ( ; offset + pattern.blockSize <= size; offset += pattern.blockSize )
+	{
+		for ( size_t c = 0; c < pattern.blockSize; c += 16 )
+		{
+			__m128i mask = _mm_loadu_si128( (const __m128i*)&pattern.masks[c] );
+			__m128i v = _mm_loadu_si128( (const __m128i*)( src + offset + c ) );
+			_mm_storeu_si128( (__m128i*)( dst + offset + c ), _mm_shuffle_epi8( v, mask ) );
+		}
+	}
+	return offset;
+}
+#endif
+
+#if ENDIAN_NEON
+size_t endswapBlocksNEON( uint8_t *dst, const uint8_t *src, size_t size, const SwapPattern &pattern )
+{
+	size_t offset = 0;
+	for ( ; offset + pattern.blockSize <= size; offset += pattern.blockSize )
+	{
+		for ( size_t c = 0; c < pattern.blockSize; c += 16 )
+		{
+			uint8x16_t mask = vld1q_u8( &pattern.masks[c] );
+			uint8x16_t v = vld1q_u8( src + offset + c );
+			vst1q_u8( dst + offset + c, vqtbl1q_u8( v, mask ) );
+		}
+	}
+	return offset;
+}
+#endif
+
+// converts count records from src into dst in one pass, dst may be the same memory as src
+void endswapArray( void *dstp, const void *srcp, size_t count, const SwapPattern &pattern )
+{
+	uint8_t *dst = (uint8_t*)dstp;
+	const uint8_t *src = (const uint8_t*)srcp;
+	size_t size = count * pattern.recordSize;
+	size_t offset = 0;
+
+	if ( pattern.simd )
+	{
+#if ENDIAN_SSSE3
+		static const bool bSSSE3 = cpuHasSSSE3();
+		if ( bSSSE3 )
+			offset = endswapBlocksSSSE3( dst, src, size, pattern );
+#elif ENDIAN_NEON
+		offset = endswapBlocksNEON( dst, src, size, pattern );
+#endif
+	}
+
+	// whatever is left over (or everything, without simd)
+	uint8_t record[256];
+	std::vector<uint8_t> bigRecord;
+	uint8_t *tmp = record;
+	if ( pattern.recordSize > sizeof(record) )
+	{
+		bigRecord.resize( pattern.recordSize );
+		tmp = bigRecord.data();
+	}
+
+	for ( ; offset < size; offset += pattern.recordSize )
+	{
+		for ( size_t i = 0; i < pattern.recordSize; i++ )
+			tmp[i] = src[offset + pattern.perm[i]];
+		memcpy( dst + offset, tmp, pattern.recordSize );
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Compile time layouts
+// Each on-disk struct is described once as a list of big endian fields, from that
+// both the per record conversion and the array swap pattern are generated.
+
+template <size_t Width>
+void swapValue( uint8_t *p );
+
+template <>
+inline void swapValue<1>( uint8_t * )
+{
+}
+
+template <>
+inline void swapValue<2>( uint8_t *p )
+{
+	uint16_t v;
+	memcpy( &v, p, 2 );
+#ifdef _MSC_VER
+	v = _byteswap_ushort( v );
+#else
+	v = __builtin_bswap16( v );
+#endif
+	memcpy( p, &v, 2 );
+}
+
+template <>
+inline void swapValue<4>( uint8_t *p )
+{
+	uint32_t v;
+	memcpy( &v, p, 4 );
+#ifdef _MSC_VER
+	v = _byteswap_ulong( v );
+#else
+	v = __builtin_bswap32( v );
+#endif
+	memcpy( p, &v, 4 );
+}
+
+template <size_t Offset, size_t Width, size_t Count>
+struct BigEndianField
+{
+	static constexpr size_t offset = Offset;
+	static constexpr size_t width = Width;
+	static constexpr size_t count = Count;
+
+	template <size_t... I>
+	static void convert( uint8_t *p, std::index_sequence<I...> )
+	{
+		( swapValue<Width>( p + Offset + I * Width ), ... );
+	}
+
+	static void convert( uint8_t *p )
+	{
+		convert( p, std::make_index_sequence<Count>() );
+	}
+};
+
+// width and count come from the member type, arrays become count values of their element
+#define BE_FIELD(T, member) BE_FIELD_AS(T, member, std::remove_all_extents_t<decltype(T::member)>)
+// for members that are structs of values, e.g. Vector3 as 3 int32_t
+#define BE_FIELD_AS(T, member, valueType) BigEndianField<offsetof(T, member), sizeof(valueType), sizeof(decltype(T::member)) / sizeof(valueType)>
+
+template <class... Fields>
+constexpr bool fieldsOverlap()
+{
+	constexpr size_t begins[] = { Fields::offset... };
+	constexpr size_t ends[] = { ( Fields::offset + Fields::width * Fields::count )... };
+	for ( size_t i = 0; i < sizeof...(Fields); i++ )
+		for ( size_t j = i + 1; j < sizeof...(Fields); j++ )
+			if ( begins[i] < ends[j] && begins[j] < ends[i] )
+				return true;
+	return false;
+}
+
+template <class T, size_t Size, class... Fields>
+struct RecordLayout
+{
+	static_assert( sizeof(T) == Size, "on-disk struct has the wrong size, check its padding" );
+	static_assert( ( ( Fields::offset + Fields::width * Fields::count <= Size ) && ... ), "field is outside of the struct" );
+	static_assert( !fieldsOverlap<Fields...>(), "fields overlap" );
+
+	static void convert( T &record )
+	{
+		uint8_t *p = (uint8_t*)&record;
+		( Fields::convert( p ), ... );
+	}
+
+	static SwapPattern pattern()
+	{
+		return makeSwapPattern( sizeof(T), { { Fields::offset, Fields::width, Fields::count }... } );
+	}
+};
+
+template <class T>
+struct Layout;
+
+// big endian -> little endian (or back) for one record
+template <class T>
+void endianConvert( T &record )
+{
+	Layout<T>::convert( record );
+}
+
+template <class T>
+const SwapPattern &swapPattern()
+{
+	static const SwapPattern pattern = Layout<T>::pattern();
+	return pattern;
+}
+
+// converts a whole array of records from the file buffer into dst
+template <class T>
+void endianConvertArray( T *dst, const void *src, size_t count )
+{
+	endswapArray( dst, src, count, swapPattern<T>() );
+}
+
+// ----------------------------------------------------------------------------
+// Layouts of the on-disk structs (needs wipeout_definitions.h)
+
+template <> struct Layout<TrackVertex> : RecordLayout<TrackVertex, 16,
+	BE_FIELD(TrackVertex, x),
+	BE_FIELD(TrackVertex, y),
+	BE_FIELD(TrackVertex, z),
+	BE_FIELD(TrackVertex, padding)> {};
+
+template <> struct Layout<TrackFace> : RecordLayout<TrackFace, 20,
+	BE_FIELD(TrackFace, indices),
+	BE_FIELD(TrackFace, normalx),
+	BE_FIELD(TrackFace, normaly),
+	BE_FIELD(TrackFace, normalz),
+	BE_FIELD(TrackFace, color)> {};
+
+template <> struct Layout<TrackTextureIndex> : RecordLayout<TrackTextureIndex, 42,
+	BE_FIELD(TrackTextureIndex, nearest),
+	BE_FIELD(TrackTextureIndex, mediumest),
+	BE_FIELD(TrackTextureIndex, farthest)> {};
+
+template <> struct Layout<TrackSection> : RecordLayout<TrackSection, 156,
+	BE_FIELD(TrackSection, nextJunction),
+	BE_FIELD(TrackSection, previous),
+	BE_FIELD(TrackSection, next),
+	BE_FIELD(TrackSection, x),
+	BE_FIELD(TrackSection, y),
+	BE_FIELD(TrackSection, z),
+	BE_FIELD(TrackSection, firstFace),
+	BE_FIELD(TrackSection, numFaces),
+	BE_FIELD(TrackSection, flag)> {};
+
+template <> struct Layout<TrackTexture> : RecordLayout<TrackTexture, 2> {};
+
+template <> struct Layout<Vertex> : RecordLayout<Vertex, 8,
+	BE_FIELD(Vertex, x),
+	BE_FIELD(Vertex, y),
+	BE_FIELD(Vertex, z),
+	BE_FIELD(Vertex, padding)> {};
+
+template <> struct Layout<ObjectHeader> : RecordLayout<ObjectHeader, 144,
+	BE_FIELD(ObjectHeader, vertexCount),
+	BE_FIELD(ObjectHeader, polygonCount),
+	BE_FIELD(ObjectHeader, index1),
+	BE_FIELD_AS(ObjectHeader, origin, int32_t),
+	BE_FIELD_AS(ObjectHeader, position, int32_t)> {};
+
+template <> struct Layout<PolygonHeader> : RecordLayout<PolygonHeader, 4,
+	BE_FIELD(PolygonHeader, type),
+	BE_FIELD(PolygonHeader, subtype)> {};
+
+template <> struct Layout<Polygon0x00> : RecordLayout<Polygon0x00, 18,
+	BE_FIELD_AS(Polygon0x00, header, uint16_t),
+	BE_FIELD(Polygon0x00, unknown)> {};
+
+template <> struct Layout<Polygon0x01> : RecordLayout<Polygon0x01, 16,
+	BE_FIELD_AS(Polygon0x01, header, uint16_t),
+	BE_FIELD(Polygon0x01, indices),
+	BE_FIELD(Polygon0x01, unknown),
+	BE_FIELD(Polygon0x01, color)> {};
+
+// uvs are single bytes and stay as they are
+template <> struct Layout<Polygon0x02> : RecordLayout<Polygon0x02, 28,
+	BE_FIELD_AS(Polygon0x02, header, uint16_t),
+	BE_FIELD(Polygon0x02, indices),
+	BE_FIELD(Polygon0x02, texture),
+	BE_FIELD(Polygon0x02, unknown),
+	BE_FIELD(Polygon0x02, unknown2),
+	BE_FIELD(Polygon0x02, color)> {};
+
+template <> struct Layout<Polygon0x03> : RecordLayout<Polygon0x03, 16,
+	BE_FIELD_AS(Polygon0x03, header, uint16_t),
+	BE_FIELD(Polygon0x03, indices),
+	BE_FIELD(Polygon0x03, color)> {};
+
+template <> struct Layout<Polygon0x04> : RecordLayout<Polygon0x04, 32,
+	BE_FIELD_AS(Polygon0x04, header, uint16_t),
+	BE_FIELD(Polygon0x04, indices),
+	BE_FIELD(Polygon0x04, texture),
+	BE_FIELD(Polygon0x04, unknown),
+	BE_FIELD(Polygon0x04, unknown2),
+	BE_FIELD(Polygon0x04, color)> {};
+
+template <> struct Layout<Polygon0x05> : RecordLayout<Polygon0x05, 24,
+	BE_FIELD_AS(Polygon0x05, header, uint16_t),
+	BE_FIELD(Polygon0x05, indices),
+	BE_FIELD(Polygon0x05, unknown),
+	BE_FIELD(Polygon0x05, colors)> {};
+
+template <> struct Layout<Polygon0x06> : RecordLayout<Polygon0x06, 36,
+	BE_FIELD_AS(Polygon0x06, header, uint16_t),
+	BE_FIELD(Polygon0x06, indices),
+	BE_FIELD(Polygon0x06, texture),
+	BE_FIELD(Polygon0x06, unknown),
+	BE_FIELD(Polygon0x06, unknown2),
+	BE_FIELD(Polygon0x06, colors)> {};
+
+template <> struct Layout<Polygon0x07> : RecordLayout<Polygon0x07, 28,
+	BE_FIELD_AS(Polygon0x07, header, uint16_t),
+	BE_FIELD(Polygon0x07, indices),
+	BE_FIELD(Polygon0x07, colors)> {};
+
+template <> struct Layout<Polygon0x08> : RecordLayout<Polygon0x08, 44,
+	BE_FIELD_AS(Polygon0x08, header, uint16_t),
+	BE_FIELD(Polygon0x08, indices),
+	BE_FIELD(Polygon0x08, texture),
+	BE_FIELD(Polygon0x08, unknown),
+	BE_FIELD(Polygon0x08, colors)> {};
+
+template <> struct Layout<Polygon0x0A> : RecordLayout<Polygon0x0A, 14,
+	BE_FIELD_AS(Polygon0x0A, header, uint16_t),
+	BE_FIELD(Polygon0x0A, index),
+	BE_FIELD(Polygon0x0A, width),
+	BE_FIELD(Polygon0x0A, height),
+	BE_FIELD(Polygon0x0A, texture),
+	BE_FIELD(Polygon0x0A, color)> {};
+
+template <> struct Layout<Polygon0x0B> : RecordLayout<Polygon0x0B, 16,
+	BE_FIELD_AS(Polygon0x0B, header, uint16_t),
+	BE_FIELD(Polygon0x0B, index),
+	BE_FIELD(Polygon0x0B, width),
+	BE_FIELD(Polygon0x0B, height),
+	BE_FIELD(Polygon0x0B, texture),
+	BE_FIELD(Polygon0x0B, color)> {};
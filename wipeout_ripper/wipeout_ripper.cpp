@@ -16,15 +16,60 @@
 #include <algorithm>
 #include <iomanip>
 #include <iterator>
-#include <experimental/filesystem>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <unordered_map>
+#include <map>
+#include <tuple>
+#include <cmath>
+#include <cerrno>
+#include <climits>
+#include <filesystem>
 
 #include "wipeout_definitions.h"
-
+#include "wipeout_endian.h"
+#include "objwriter.h"
+#include "glb.h"
+#include "ply.h"
+#include "wmsh.h"
+#include "trackbvh.h"
+#include "trackgraph.h"
+#include "bounds.h"
+
+// keep the min/max macros out, they break std::min and std::max
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
 #include <Windows.h>
 
 // false = wipeout, true = wipeout2097
 bool bSequel = false;
 
+// --object <name|index>, a selector made of digits also matches by position in the .PRM
+struct ObjectSelector
+{
+	std::string name;
+	int			index;	// -1 when the selector isn't a number, or too big to be one
+};
+
+// command line options
+struct Options
+{
+	std::vector<ObjectSelector> objects;			// --object <name|index>, only rip these objects from every .PRM
+	bool					 bListObjects = false;	// --list-objects, print the object table of every .PRM
+	int						 threads = 0;			// --threads <n>, 0 = one per core
+	std::vector<std::string> formats = { "textures", "obj" };	// --formats <a,b,..>, the export sinks to run
+	bool					 bWeld = false;			// --weld, merge identical vertices before writing meshes
+	bool					 bVertexCache = false;	// --vcache, reorder triangles and vertices for the gpu caches, implies --weld
+	bool					 bMorton = false;		// --morton, sort the track along a z-order curve before exporting
+	size_t					 chunkSections = 1;		// --chunk-sections <n>, sections per chunk for the chunked exports
+};
+
+Options options;
+
 // debug text, makes execution significantly slower
 #define DEBUG_OUTPUT 0
 // prefer .bmp or .tga?
@@ -35,20 +80,31 @@ bool bSequel = false;
 //
 // helper functions
 //
+
+// the sinks run concurrently, so each line is built first and written in one go
+std::mutex printMutex;
+
+template <typename... Args>
+void printLine( const Args &... args )
+{
+	std::ostringstream line;
+	( ( line << args ), ... );
+	line << "\n";
+
+	std::lock_guard<std::mutex> lock( printMutex );
+	std::cout << line.str();
+}
+
 void printText( std::string text, bool important = false )
 {
 	if ( important )
 	{
-		std::cout << "\n";
-		std::cout << text << "\n";
-		std::cout << "\n";	
+		printLine( "\n", text, "\n" );
 	}
 	else
 	{
 #if DEBUG_OUTPUT
-		std::cout << "\n";
-		std::cout << text << "\n";
-		std::cout << "\n";
+		printLine( "\n", text, "\n" );
 #endif
 	}
 }
@@ -68,6 +124,128 @@ int getFileSize( const std::string &fileName )
 }
 
 
+// read a whole file into memory with a single read
+bool readFile( const std::string &fileName, std::vector<uint8_t> &data )
+{
+	std::ifstream file(fileName.c_str(), std::ifstream::in | std::ifstream::binary);
+
+	if ( !file.is_open() )
+		return false;
+
+	file.seekg(0, std::ifstream::end);
+	std::streamoff fileSize = file.tellg();
+	file.seekg(0, std::ifstream::beg);
+
+	data.resize( (size_t)fileSize );
+	if ( fileSize > 0 )
+		file.read((char*)data.data(), fileSize);
+
+	return !file.fail();
+}
+
+// read a file of fixed size records straight into the array, a partial record at the end is dropped
+template <class T>
+bool readArray( const std::string &fileName, std::vector<T> &records )
+{
+	std::ifstream file(fileName.c_str(), std::ifstream::in | std::ifstream::binary);
+
+	if ( !file.is_open() )
+		return false;
+
+	file.seekg(0, std::ifstream::end);
+	std::streamoff fileSize = file.tellg();
+	file.seekg(0, std::ifstream::beg);
+
+	records.resize( (size_t)fileSize / sizeof(T) );
+	if ( records.size() )
+		file.read((char*)records.data(), records.size() * sizeof(T));
+
+	return !file.fail();
+}
+
+// big endian loads, safe for unaligned data
+uint16_t loadBE16( const uint8_t *p )
+{
+	return (uint16_t)( ( p[0] << 8 ) | p[1] );
+}
+
+uint32_t loadBE32( const uint8_t *p )
+{
+	return ( (uint32_t)p[0] << 24 ) | ( (uint32_t)p[1] << 16 ) | ( (uint32_t)p[2] << 8 ) | (uint32_t)p[3];
+}
+
+// walks a file that has been read into memory, replaces seekg + read per record
+struct ByteCursor
+{
+	const uint8_t *data;
+	size_t		   size;
+	size_t		   offset;
+
+	bool canRead( size_t length ) const
+	{
+		return offset <= size && length <= size - offset;
+	}
+
+	const uint8_t *current() const
+	{
+		return data + offset;
+	}
+
+	// copies the raw (still big endian) record and advances past it
+	template <class T>
+	bool read( T &out )
+	{
+		if ( !canRead( sizeof(T) ) )
+			return false;
+
+		memcpy( &out, data + offset, sizeof(T) );
+		offset += sizeof(T);
+		return true;
+	}
+};
+
+int workerCount()
+{
+	if ( options.threads > 0 )
+		return options.threads;
+
+	return std::max( 1u, std::thread::hardware_concurrency() );
+}
+
+// set on the worker threads, a parallelFor inside one runs inline so there are never more than --threads
+thread_local bool bWorkerThread = false;
+
+// runs fn(i) for every i in [0, count) on the worker threads
+// fn must only write to its own slot i, so results don't depend on the number of threads
+template <class Fn>
+void parallelFor( size_t count, Fn fn )
+{
+	size_t threadCount = bWorkerThread ? 1 : std::min( (size_t)workerCount(), count );
+
+	if ( threadCount <= 1 )
+	{
+		for ( size_t i = 0; i < count; i++ )
+			fn( i );
+		return;
+	}
+
+	std::atomic<size_t> next( 0 );
+	std::vector<std::thread> threads;
+
+	for ( size_t t = 0; t < threadCount; t++ )
+	{
+		threads.emplace_back( [&]()
+		{
+			bWorkerThread = true;
+			for ( size_t i = next++; i < count; i = next++ )
+				fn( i );
+		} );
+	}
+
+	for ( size_t t = 0; t < threadCount; t++ )
+		threads[t].join();
+}
+
 Color int32ToColor( int32_t v )
 {
 	Color color;
@@ -77,14 +255,6 @@ Color int32ToColor( int32_t v )
 	return color;
 }
 
-// required to convert big endian -> little endian
-template <class T>
-void endswap(T *objp)
-{
-  char *memp = (char*)(objp);
-  std::reverse(memp, memp + sizeof(T));
-}
-
 template<typename T>
 // slice an array
 std::vector<T> slice(std::vector<T> const &v, int m, int n)
@@ -96,17 +266,10 @@ std::vector<T> slice(std::vector<T> const &v, int m, int n)
 	return vec;
 }
 
-template<class T>
-// reverse an uint16_t array
-void reverse(T arr[], int n)
-{
-	std::reverse(arr, arr + n);
-}
-
 // get all names of files in this folder
-std::vector<std::string> get_filenames( std::experimental::filesystem::path path )
+std::vector<std::string> get_filenames( std::filesystem::path path )
 {
-    namespace stdfs = std::experimental::filesystem ;
+    namespace stdfs = std::filesystem ;
 
     std::vector<std::string> filenames ;
     
@@ -152,7 +315,7 @@ uint8_t readBitfield( int size, int &bitMask, int &curByte, std::vector<uint8_t>
 std::vector<std::vector<uint8_t>> unpackImages( const char *filename )
 {
 #if DEBUG_OUTPUT
-	std::cout << "Unpacking images..." << "\n";
+	printLine( "Unpacking images..." );
 #endif
 
 	std::string name(filename);
@@ -162,13 +325,13 @@ std::vector<std::vector<uint8_t>> unpackImages( const char *filename )
 
 	if ( !fileTextures.is_open() )
 	{
-		std::cout << "Error! " << name << " is missing or corrupt!" << "\n";
+		printLine( "Error! ", name, " is missing or corrupt!" );
 		system("pause");
 		std::exit(0);
 	}
 
 #if DEBUG_OUTPUT
-	std::cout << "Getting number of files..." << "\n";
+	printLine( "Getting number of files..." );
 #endif
 
 	int offset = 0;
@@ -182,7 +345,7 @@ std::vector<std::vector<uint8_t>> unpackImages( const char *filename )
 	int unpackedLength = 0;
 
 #if DEBUG_OUTPUT
-	std::cout << "Number of files: " << std::to_string(numberOfFiles) << "\n";
+	printLine( "Number of files: ", std::to_string(numberOfFiles) );
 #endif
 
 	for( unsigned int i = 0; i < numberOfFiles; i++ ) 
@@ -194,10 +357,10 @@ std::vector<std::vector<uint8_t>> unpackImages( const char *filename )
 	}
 
 #if DEBUG_OUTPUT
-	std::cout << "Unpacked length: " << std::to_string(unpackedLength) << "\n";
-	std::cout << "Packed data offset: " << std::to_string(packedDataOffset) << "\n";
+	printLine( "Unpacked length: ", std::to_string(unpackedLength) );
+	printLine( "Packed data offset: ", std::to_string(packedDataOffset) );
 
-	std::cout << "Building src byte array..." << "\n";
+	printLine( "Building src byte array..." );
 #endif
 
 	std::vector<uint8_t> src;
@@ -218,7 +381,7 @@ std::vector<std::vector<uint8_t>> unpackImages( const char *filename )
 	}
 
 #if DEBUG_OUTPUT
-	std::cout << "Building dst byte array..." << "\n";
+	printLine( "Building dst byte array..." );
 #endif
 
 	std::vector<uint8_t> dst;
@@ -229,7 +392,7 @@ std::vector<std::vector<uint8_t>> unpackImages( const char *filename )
 	}
 
 #if DEBUG_OUTPUT
-	std::cout << "Building wnd byte array..." << "\n";
+	printLine( "Building wnd byte array..." );
 #endif
 
 	std::vector<uint8_t> wnd;
@@ -247,7 +410,7 @@ std::vector<std::vector<uint8_t>> unpackImages( const char *filename )
 	int bitMask = 0x80;
 
 #if DEBUG_OUTPUT
-	std::cout << "Unpacking src bytes..." << "\n";
+	printLine( "Unpacking src bytes..." );
 #endif
 
 	auto readBitfield = [&]( int size ) 
@@ -322,7 +485,7 @@ std::vector<std::vector<uint8_t>> unpackImages( const char *filename )
 	}
 
 #if DEBUG_OUTPUT
-	std::cout << "Slicing dst bytes array..." << "\n";
+	printLine( "Slicing dst bytes array..." );
 #endif
 
 	// Split unpacked data into separate buffer for each file
@@ -340,9 +503,9 @@ std::vector<std::vector<uint8_t>> unpackImages( const char *filename )
 	}
 
 #if DEBUG_OUTPUT
-	std::cout << "Image unpacking finished successfully!" << "\n";
+	printLine( "Image unpacking finished successfully!" );
 
-	std::cout << "Number of unpacked image files: " << std::to_string( files.size() ) << "\n";
+	printLine( "Number of unpacked image files: ", std::to_string( files.size() ) );
 #endif
 
 	return files;
@@ -359,7 +522,7 @@ void putPixel(std::vector<uint8_t> &dst, int offset, uint16_t color)
 std::vector<Image> readImages( std::vector<std::vector<uint8_t>> &rawImages )
 {
 #if DEBUG_OUTPUT
-	std::cout << "Reading images..." << "\n";
+	printLine( "Reading images..." );
 #endif
 
 	std::vector<Image> images;
@@ -369,7 +532,7 @@ std::vector<Image> readImages( std::vector<std::vector<uint8_t>> &rawImages )
 	for ( size_t ii = 0; ii < rawImages.size(); ii++ )
 	{
 #if DEBUG_OUTPUT
-		std::cout << "Reading image index: " << std::to_string(imageindex) << "\n";
+		printLine( "Reading image index: ", std::to_string(imageindex) );
 #endif
 
 		int offset = 0;
@@ -380,7 +543,7 @@ std::vector<Image> readImages( std::vector<std::vector<uint8_t>> &rawImages )
 		image.pop_back();
 
 #if DEBUG_OUTPUT
-		std::cout << "Getting image header..." << "\n";
+		printLine( "Getting image header..." );
 #endif
 
 		ImageFileHeader file;
@@ -388,7 +551,7 @@ std::vector<Image> readImages( std::vector<std::vector<uint8_t>> &rawImages )
 		offset += sizeof(file);
 
 #if DEBUG_OUTPUT
-		std::cout << "Getting image pallete..." << "\n";
+		printLine( "Getting image pallete..." );
 #endif
 
 		std::vector<uint16_t> palette;
@@ -420,7 +583,7 @@ std::vector<Image> readImages( std::vector<std::vector<uint8_t>> &rawImages )
 		offset += 4; // skip data size
 
 #if DEBUG_OUTPUT
-		std::cout << "Getting image pixel header..." << "\n";
+		printLine( "Getting image pixel header..." );
 #endif
 
 		int pixelsPerShort = 1;
@@ -446,9 +609,9 @@ std::vector<Image> readImages( std::vector<std::vector<uint8_t>> &rawImages )
 		}
 
 #if DEBUG_OUTPUT
-		std::cout << "Pixel count: " << std::to_string(pixels.size()) << "\n";
+		printLine( "Pixel count: ", std::to_string(pixels.size()) );
 
-		std::cout << "Read pixels..." << "\n";
+		printLine( "Read pixels..." );
 #endif
 
 		if ( file.type == TRUE_COLOR_16_BPP )
@@ -499,14 +662,14 @@ std::vector<Image> readImages( std::vector<std::vector<uint8_t>> &rawImages )
 	return images;
 
 #if DEBUG_OUTPUT
-	std::cout << "Image reading successful!" << "\n";
+	printLine( "Image reading successful!" );
 #endif
 };
 
 void writeRawTrackImages( std::vector<Image> &images )
 {
 #if DEBUG_OUTPUT
-	std::cout << "Writing raw images..." << "\n";
+	printLine( "Writing raw images..." );
 #endif
 
 	int imageindex = 0;
@@ -517,14 +680,14 @@ void writeRawTrackImages( std::vector<Image> &images )
 
 #if WRITE_BMP
 #if DEBUG_OUTPUT
-		std::cout << "Init BMP of width and height: " << std::to_string(image.width) << " " << std::to_string(image.height) << "\n";
+		printLine( "Init BMP of width and height: ", std::to_string(image.width), " ", std::to_string(image.height) );
 #endif
 
 		BMP theBMP( image.width, image.height, true );
 
 		int pixeloffset = 0;
 
-		std::cout << "Write raw pixels to BMP..." << "\n";
+		printLine( "Write raw pixels to BMP..." );
 
 		for ( int x = 0; x < image.width; x++ )
 		{
@@ -550,7 +713,7 @@ void writeRawTrackImages( std::vector<Image> &images )
 		}
 
 #if DEBUG_OUTPUT
-		std::cout << "Saving BMP..." << "\n";
+		printLine( "Saving BMP..." );
 #endif
 
 		std::string filename = "ripped_track_raw/track_";
@@ -561,7 +724,7 @@ void writeRawTrackImages( std::vector<Image> &images )
 		theBMP.write( cc );
 #else //tga
 #if DEBUG_OUTPUT
-		std::cout << "Init TGA of width and height: " << std::to_string(image.width) << " " << std::to_string(image.height) << "\n";
+		printLine( "Init TGA of width and height: ", std::to_string(image.width), " ", std::to_string(image.height) );
 #endif
 		std::string filename = "ripped_track_raw/track_";
 		filename += std::to_string(imageindex);
@@ -585,12 +748,13 @@ void writeRawTrackImages( std::vector<Image> &images )
 		imageindex++;	
 	}
 
-	std::cout << "Raw image writing successful!" << "\n" << "\n";
+	printLine( "Raw image writing successful!" );
+	printLine();
 }
 
-void writeTrackImages( Track &theTrack )
+void writeTrackImages( const Track &theTrack )
 {
-	std::cout << "Writing combined images..." << "\n";
+	printLine( "Writing combined images..." );
 
 	int imageindex = 0;
 
@@ -602,13 +766,13 @@ void writeTrackImages( Track &theTrack )
 		// note: .bmps must be corrected with a rotation of 90 degrees clockwise!
 #if /*WRITE_BMP*/ 1
 #if DEBUG_OUTPUT
-		std::cout << "Init BMP of width and height: " << std::to_string(image.width) << " " << std::to_string(image.height) << "\n";
+		printLine( "Init BMP of width and height: ", std::to_string(image.width), " ", std::to_string(image.height) );
 #endif
 
 		BMP theBMP( image.width, image.height, true );
 
 #if DEBUG_OUTPUT
-		std::cout << "Write combined pixels to BMP..." << "\n";
+		printLine( "Write combined pixels to BMP..." );
 #endif
 
 		int pixeloffset = 0;
@@ -650,7 +814,7 @@ void writeTrackImages( Track &theTrack )
 		}
 
 #if DEBUG_OUTPUT
-		std::cout << "Saving BMP..." << "\n";
+		printLine( "Saving BMP..." );
 #endif
 
 		std::string filename = "ripped_track/track_";
@@ -671,7 +835,7 @@ void writeTrackImages( Track &theTrack )
 		theBMP.write( cc );
 #else //tga
 #if DEBUG_OUTPUT
-		std::cout << "Init TGA of width and height: " << std::to_string(image.width) << " " << std::to_string(image.height) << "\n";
+		printLine( "Init TGA of width and height: ", std::to_string(image.width), " ", std::to_string(image.height) );
 #endif
 		std::string filename = "ripped_track/track_";
 		filename += std::to_string(imageindex);
@@ -685,272 +849,286 @@ void writeTrackImages( Track &theTrack )
 		imageindex++;	
 	}
 
-	std::cout << "Combined image writing successful!" << "\n";
+	printLine( "Combined image writing successful!" );
 }
 
 //
 // object
 //
 
-Object readObject(std::ifstream& buffer, int offset )
+// size of a polygon record, 0 if the type is unknown
+size_t polygonSize( uint16_t type )
+{
+	switch ( type )
+	{
+		case UNKNOWN_00:				 return sizeof(Polygon0x00);
+		case FLAT_TRIS_FACE_COLOR:		 return sizeof(Polygon0x01);
+		case TEXTURED_TRIS_FACE_COLOR:	 return sizeof(Polygon0x02);
+		case FLAT_QUAD_FACE_COLOR:		 return sizeof(Polygon0x03);
+		case TEXTURED_QUAD_FACE_COLOR:	 return sizeof(Polygon0x04);
+		case FLAT_TRIS_VERTEX_COLOR:	 return sizeof(Polygon0x05);
+		case TEXTURED_TRIS_VERTEX_COLOR: return sizeof(Polygon0x06);
+		case FLAT_QUAD_VERTEX_COLOR:	 return sizeof(Polygon0x07);
+		case TEXTURED_QUAD_VERTEX_COLOR: return sizeof(Polygon0x08);
+		case SPRITE_TOP_ANCHOR:			 return sizeof(Polygon0x0A);
+		case SPRITE_BOTTOM_ANCHOR:		 return sizeof(Polygon0x0B);
+	}
+	return 0;
+}
+
+std::string objectName( const ObjectHeader &header )
+{
+	// the name isn't always null terminated
+	return std::string( header.name, strnlen( header.name, sizeof(header.name) ) );
+}
+
+// pre-scan of a .PRM, only reads the object headers and the polygon types to find where each object starts
+std::vector<ObjectIndexEntry> indexObjects( const std::vector<uint8_t> &buffer )
+{
+	std::vector<ObjectIndexEntry> index;
+	ByteCursor cursor = { buffer.data(), buffer.size(), 0 };
+
+	while ( cursor.offset < cursor.size )
+	{
+		ObjectIndexEntry entry;
+		entry.offset = cursor.offset;
+
+		ObjectHeader header;
+		if ( !cursor.read( header ) )
+			break;
+		endianConvert( header );
+
+		entry.name = objectName( header );
+		entry.vertexCount = header.vertexCount;
+		entry.polygonCount = header.polygonCount;
+		entry.position = header.position;
+
+		cursor.offset = std::min( cursor.size, cursor.offset + header.vertexCount * sizeof(Vertex) );
+
+		for ( int i = 0; i < header.polygonCount; i++ )
+		{
+			if ( !cursor.canRead( sizeof(PolygonHeader) ) )
+				break;
+
+			size_t size = polygonSize( loadBE16( cursor.current() + offsetof(PolygonHeader, type) ) );
+			if ( size == 0 || !cursor.canRead( size ) )
+				break;
+
+			cursor.offset += size;
+		}
+
+		entry.byteLength = cursor.offset - entry.offset;
+		index.push_back( entry );
+	}
+
+	return index;
+}
+
+bool objectSelected( const ObjectIndexEntry &entry, int index )
+{
+	if ( options.objects.empty() )
+		return true;
+
+	for ( size_t i = 0; i < options.objects.size(); i++ )
+	{
+		const ObjectSelector &selector = options.objects[i];
+		if ( selector.name == entry.name || ( selector.index >= 0 && selector.index == index ) )
+			return true;
+	}
+
+	return false;
+}
+
+void printObjectIndex( const std::vector<ObjectIndexEntry> &index )
+{
+	printLine( std::setw(6), "index", " ", std::left, std::setw(16), "name", std::right,
+		std::setw(10), "offset", std::setw(10), "vertices", std::setw(10), "polygons",
+		"  position" );
+
+	for ( size_t i = 0; i < index.size(); i++ )
+	{
+		printLine( std::setw(6), i, " ", std::left, std::setw(16), index[i].name, std::right,
+			std::setw(10), index[i].offset, std::setw(10), index[i].vertexCount, std::setw(10), index[i].polygonCount,
+			"  ", index[i].position.x, " ", index[i].position.y, " ", index[i].position.z );
+	}
+
+	printLine();
+}
+
+Object readObject( const std::vector<uint8_t> &buffer, size_t offset )
 {
 	Object object;
+	object.byteLength = 0;
 
-	int initialOffset = offset;
+	ByteCursor cursor = { buffer.data(), buffer.size(), offset };
 
-	buffer.seekg( offset );
 	ObjectHeader header;
-	buffer.read((char*)&header, sizeof(header));
-	//endswap(&header.name);
-	endswap(&header.vertexCount);
-	endswap(&header.polygonCount);
-	endswap(&header.index1);
-	endswap(&header.origin);
-	endswap(&header.position);
-	// HACK: swap origin and position values, i dont know why its out of order
-	Vector3 origin = header.origin;
-	Vector3 position = header.position;
-	header.origin.x = origin.z;
-	header.origin.z = origin.x;
-	header.position.x = position.z;
-	header.position.z = position.x;
-	offset += sizeof(header);
+	if ( !cursor.read( header ) )
+		return object;
+	endianConvert( header );
 	object.header = header;
 
-	for ( int i = 0; i < header.vertexCount; i++ )
+	// the vertices are one contiguous run, convert them in a single pass
+	size_t vertexCount = header.vertexCount;
+	if ( !cursor.canRead( vertexCount * sizeof(Vertex) ) )
+		vertexCount = ( cursor.size - cursor.offset ) / sizeof(Vertex);
+
+	std::vector<Vertex> vertices( vertexCount );
+	endianConvertArray( vertices.data(), cursor.current(), vertexCount );
+	cursor.offset += vertexCount * sizeof(Vertex);
+
+	object.vertices.resize( vertexCount );
+	for ( size_t i = 0; i < vertexCount; i++ )
 	{
-		buffer.seekg(offset);
-		Vertex vertex;
-		buffer.read((char*)&vertex, sizeof(vertex));
-		endswap(&vertex.x);
-		endswap(&vertex.y);
-		endswap(&vertex.z);
-		offset += sizeof(vertex);
-		Vertex32 vertex32;
-		vertex32.x = (int32_t)vertex.x;
-		vertex32.y = (int32_t)vertex.y;
-		vertex32.z = (int32_t)vertex.z;
-		object.vertices.push_back( vertex32 );
+		object.vertices[i].x = vertices[i].x;
+		object.vertices[i].y = vertices[i].y;
+		object.vertices[i].z = vertices[i].z;
 	}
 
+	object.polygons.reserve( header.polygonCount );
+
 	for ( int i = 0; i < header.polygonCount; i++ )
 	{
-		buffer.seekg( offset );
-		PolygonHeader polyheader;
-		buffer.read((char*)&polyheader, sizeof(polyheader));
-		endswap(&polyheader.type);
-		endswap(&polyheader.subtype);
-		buffer.seekg(offset);
-
-		Polygon0x00 polygon0x00;
-		Polygon0x01 polygon0x01;
-		Polygon0x02 polygon0x02;
-		Polygon0x03 polygon0x03;
-		Polygon0x04 polygon0x04;
-		Polygon0x05 polygon0x05;
-		Polygon0x06 polygon0x06;
-		Polygon0x07 polygon0x07;
-		Polygon0x08 polygon0x08;
-		Polygon0x0A polygon0x0A;
-		Polygon0x0B polygon0x0B;
+		// peek the type, the full record is decoded straight from the buffer below
+		if ( !cursor.canRead( sizeof(PolygonHeader) ) )
+			break;
+
+		uint16_t type = loadBE16( cursor.current() + offsetof(PolygonHeader, type) );
 
 		PolygonBase polygon;
+		bool valid = true;
 
-		switch ( polyheader.type )
+		switch ( type )
 		{
 			case UNKNOWN_00:
-				buffer.read((char*)&polygon0x00, sizeof(polygon0x00));
-				endswap(&polygon0x00.header);
-				offset += sizeof(polygon0x00);
-				polygon.type = UNKNOWN_00;
-				polygon.polygon0x00 = polygon0x00;
-				object.polygons.push_back(polygon);
+				valid = cursor.read( polygon.polygon0x00 );
+				endianConvert( polygon.polygon0x00 );
 				break;
 			case FLAT_TRIS_FACE_COLOR:
-				buffer.read((char*)&polygon0x01, sizeof(polygon0x01));
-				endswap(&polygon0x01.header);
-				endswap(&polygon0x01.indices);
-				endswap(&polygon0x01.color);
-				offset += sizeof(polygon0x01);
-				polygon.type = FLAT_TRIS_FACE_COLOR;
-				polygon.polygon0x01 = polygon0x01;
-				object.polygons.push_back(polygon);
+				valid = cursor.read( polygon.polygon0x01 );
+				endianConvert( polygon.polygon0x01 );
 				break;
 			case TEXTURED_TRIS_FACE_COLOR:
-				buffer.read((char*)&polygon0x02, sizeof(polygon0x02));
-				endswap(&polygon0x02.header);
-				endswap(&polygon0x02.indices);
-				endswap(&polygon0x02.texture);
-				endswap(&polygon0x02.uv);
-				endswap(&polygon0x02.color);
-				offset += sizeof(polygon0x02);
-				polygon.type = TEXTURED_TRIS_FACE_COLOR;
-				polygon.polygon0x02 = polygon0x02;
-				object.polygons.push_back(polygon);
+				valid = cursor.read( polygon.polygon0x02 );
+				endianConvert( polygon.polygon0x02 );
 				break;
 			case FLAT_QUAD_FACE_COLOR:
-				buffer.read((char*)&polygon0x03, sizeof(polygon0x03));
-				endswap(&polygon0x03.header);
-				endswap(&polygon0x03.indices);
-				endswap(&polygon0x03.color);
-				offset += sizeof(polygon0x03);
-				polygon.type = FLAT_QUAD_FACE_COLOR;
-				polygon.polygon0x03 = polygon0x03;
-				object.polygons.push_back(polygon);
+				valid = cursor.read( polygon.polygon0x03 );
+				endianConvert( polygon.polygon0x03 );
 				break;
 			case TEXTURED_QUAD_FACE_COLOR:
-				buffer.read((char*)&polygon0x04, sizeof(polygon0x04));
-				endswap(&polygon0x04.header);
-				endswap(&polygon0x04.indices);
-				endswap(&polygon0x04.texture);
-				endswap(&polygon0x04.uv);
-				endswap(&polygon0x04.color);
-				offset += sizeof(polygon0x04);
-				polygon.type = TEXTURED_QUAD_FACE_COLOR;
-				polygon.polygon0x04 = polygon0x04;
-				object.polygons.push_back(polygon);
+				valid = cursor.read( polygon.polygon0x04 );
+				endianConvert( polygon.polygon0x04 );
 				break;
 			case FLAT_TRIS_VERTEX_COLOR:
-				buffer.read((char*)&polygon0x05, sizeof(polygon0x05));
-				endswap(&polygon0x05.header);
-				endswap(&polygon0x05.indices);
-				endswap(&polygon0x05.colors);
-				offset += sizeof(polygon0x05);
-				polygon.type = FLAT_TRIS_VERTEX_COLOR;
-				polygon.polygon0x05 = polygon0x05;
-				object.polygons.push_back(polygon);
+				valid = cursor.read( polygon.polygon0x05 );
+				endianConvert( polygon.polygon0x05 );
 				break;
 			case TEXTURED_TRIS_VERTEX_COLOR:
-				buffer.read((char*)&polygon0x06, sizeof(polygon0x06));
-				endswap(&polygon0x06.header);
-				endswap(&polygon0x06.indices);
-				endswap(&polygon0x06.texture);
-				endswap(&polygon0x06.uv);
-				endswap(&polygon0x06.colors);
-				offset += sizeof(polygon0x06);
-				polygon.type = TEXTURED_TRIS_VERTEX_COLOR;
-				polygon.polygon0x06 = polygon0x06;
-				object.polygons.push_back(polygon);
+				valid = cursor.read( polygon.polygon0x06 );
+				endianConvert( polygon.polygon0x06 );
 				break;
 			case FLAT_QUAD_VERTEX_COLOR:
-				buffer.read((char*)&polygon0x07, sizeof(polygon0x07));
-				endswap(&polygon0x07.header);
-				endswap(&polygon0x07.indices);
-				endswap(&polygon0x07.colors);
-				offset += sizeof(polygon0x07);
-				polygon.type = FLAT_QUAD_VERTEX_COLOR;
-				polygon.polygon0x07 = polygon0x07;
-				object.polygons.push_back(polygon);
+				valid = cursor.read( polygon.polygon0x07 );
+				endianConvert( polygon.polygon0x07 );
 				break;
 			case TEXTURED_QUAD_VERTEX_COLOR:
-				buffer.read((char*)&polygon0x08, sizeof(polygon0x08));
-				endswap(&polygon0x08.header);
-				endswap(&polygon0x08.indices);
-				endswap(&polygon0x08.texture);
-				endswap(&polygon0x08.uv);
-				endswap(&polygon0x08.colors);
-				offset += sizeof(polygon0x08);
-				polygon.type = TEXTURED_QUAD_VERTEX_COLOR;
-				polygon.polygon0x08 = polygon0x08;
-				object.polygons.push_back(polygon);
+				valid = cursor.read( polygon.polygon0x08 );
+				endianConvert( polygon.polygon0x08 );
 				break;
 			case SPRITE_TOP_ANCHOR:
-				buffer.read((char*)&polygon0x0A, sizeof(polygon0x0A));
-				endswap(&polygon0x0A.header);
-				endswap(&polygon0x0A.index);
-				endswap(&polygon0x0A.width);
-				endswap(&polygon0x0A.height);
-				endswap(&polygon0x0A.texture);
-				endswap(&polygon0x0A.color);
-				offset += sizeof(polygon0x0A);
-				polygon.type = SPRITE_TOP_ANCHOR;
-				polygon.polygon0x0A = polygon0x0A;
-				object.polygons.push_back(polygon);
+				valid = cursor.read( polygon.polygon0x0A );
+				endianConvert( polygon.polygon0x0A );
 				break;
 			case SPRITE_BOTTOM_ANCHOR:
-				buffer.read((char*)&polygon0x0B, sizeof(polygon0x0B));
-				endswap(&polygon0x0B.header);
-				endswap(&polygon0x0B.index);
-				endswap(&polygon0x0B.width);
-				endswap(&polygon0x0B.height);
-				endswap(&polygon0x0B.texture);
-				endswap(&polygon0x0B.color);
-				offset += sizeof(polygon0x0B);
-				polygon.type = SPRITE_BOTTOM_ANCHOR;
-				polygon.polygon0x0B = polygon0x0B;
-				object.polygons.push_back(polygon);
+				valid = cursor.read( polygon.polygon0x0B );
+				endianConvert( polygon.polygon0x0B );
+				break;
+			default:
+				// unknown polygon type, its size can't be known so nothing after it can be read
+				valid = false;
 				break;
 		}
+
+		if ( !valid )
+			break;
+
+		polygon.type = (PolygonType)type;
+		object.polygons.push_back(polygon);
 	}
 
-	object.byteLength = offset - initialOffset;
+	object.byteLength = cursor.offset - offset;
+
+	const float position[3] = { (float)object.header.position.x, (float)object.header.position.y, (float)object.header.position.z };
+	object.bounds = bounds_points( (const int32_t*)object.vertices.data(), 3, object.vertices.size(), position );
 
 #if DEBUG_OUTPUT
-	std::cout << "Object header:" << "\n";
-	std::cout << "name: " << object.header.name << "\n";
-	std::cout << "vertexCount: " << std::to_string(object.header.vertexCount) << "\n";
-	std::cout << "polygonCount: " << std::to_string(object.header.polygonCount) << "\n";
-	std::cout << "index1: " << std::to_string(object.header.index1) << "\n";
-	std::cout << "origin xyz: " << std::to_string(object.header.origin.x) << " "
-		<< std::to_string(object.header.origin.y) << " "
-		<< std::to_string(object.header.origin.z) 
-		<< "\n";
-	std::cout << "position xyz: " << std::to_string(object.header.position.x) << " "
-		<< std::to_string(object.header.position.y) << " "
-		<< std::to_string(object.header.position.z)
-		<< "\n";
-	std::cout << "bytelength: " << std::to_string(object.byteLength) << "\n";
+	printLine( "Object header:" );
+	printLine( "name: ", object.header.name );
+	printLine( "vertexCount: ", std::to_string(object.header.vertexCount) );
+	printLine( "polygonCount: ", std::to_string(object.header.polygonCount) );
+	printLine( "index1: ", std::to_string(object.header.index1) );
+	printLine( "origin xyz: ", std::to_string(object.header.origin.x), " ",
+		std::to_string(object.header.origin.y), " ",
+		std::to_string(object.header.origin.z) );
+	printLine( "position xyz: ", std::to_string(object.header.position.x), " ",
+		std::to_string(object.header.position.y), " ",
+		std::to_string(object.header.position.z) );
+	printLine( "bytelength: ", std::to_string(object.byteLength) );
 #endif
 
 	return object;
 }
 
-std::vector<Object> readObjects( std::ifstream& buffer, int fileSize )
-{
-	int offset = 0;
-	int i = 0;
-	std::vector<Object> objects;
-	while ( offset < fileSize ) 
-	{
-		objects.push_back( readObject( buffer, offset ) );
-		offset += objects[i].byteLength;
-		i++;
-	}
-
-	return objects;
-}
-
 std::vector<Object> loadObjects( const char *filename )
 {
 	std::string name(filename);
 
-	std::cout << "Reading 3D Objects from " << name << "..." << "\n" ;
+	printLine( "Reading 3D Objects from ", name, "..." );
 
-	std::ifstream fileprm;
-	fileprm.open( name, std::ifstream::in | std::ifstream::binary );
-	if ( !fileprm.is_open() )
+	std::vector<uint8_t> fileprm;
+	if ( !readFile( name, fileprm ) )
 	{
 		printText( "Error! Object .PRM is corrupt or missing!" );
 		system("pause");
 		std::exit(0);
 	}
 
-	int fileSize = getFileSize( name );
-	std::cout << "Filesize of Object .PRM : " << std::to_string( getFileSize( name ) ) << "\n";
+	printLine( "Filesize of Object .PRM : ", std::to_string( fileprm.size() ) );
+
+	// the pre-scan finds where every object starts, so they can all be parsed at once
+	std::vector<ObjectIndexEntry> index = indexObjects( fileprm );
+
+	if ( options.bListObjects )
+		printObjectIndex( index );
+
+	std::vector<size_t> selected;
+	for ( size_t i = 0; i < index.size(); i++ )
+	{
+		if ( objectSelected( index[i], i ) )
+			selected.push_back( i );
+	}
+
+	std::vector<Object> fileObjects( selected.size() );
+
+	parallelFor( selected.size(), [&]( size_t i )
+	{
+		fileObjects[i] = readObject( fileprm, index[selected[i]].offset );
+		fileObjects[i].index = selected[i];
+	} );
 
-	std::vector<Object> fileObjects = readObjects( fileprm, fileSize );
 	int fileObjectsCount = fileObjects.size();
 
 	printText( "3D Objects from Object .PRM read succesfully." );
-	std::cout << "3D Objects count: " << std::to_string( fileObjectsCount ) << "\n";
-	std::cout << "\n";
+	printLine( "3D Objects count: ", std::to_string( fileObjectsCount ) );
+	printLine();
 
 	return fileObjects;
 }
 
-void writeObjectImages( std::vector<Image> &images, const char *filename, const char *path )
+void writeObjectImages( const std::vector<Image> &images, const char *filename, const char *path )
 {
-	std::cout << "Writing object images..." << "\n";
+	printLine( "Writing object images..." );
 
 	int imageindex = 0;
 
@@ -960,7 +1138,7 @@ void writeObjectImages( std::vector<Image> &images, const char *filename, const
 
 #if WRITE_BMP
 #if DEBUG_OUTPUT
-		std::cout << "Init BMP of width and height: " << std::to_string(image.width) << " " << std::to_string(image.height) << "\n";
+		printLine( "Init BMP of width and height: ", std::to_string(image.width), " ", std::to_string(image.height) );
 #endif
 
 		BMP theBMP( image.width, image.height, true );
@@ -968,7 +1146,7 @@ void writeObjectImages( std::vector<Image> &images, const char *filename, const
 		int pixeloffset = 0;
 
 #if DEBUG_OUTPUT
-		std::cout << "Write pixels to BMP..." << "\n";
+		printLine( "Write pixels to BMP..." );
 #endif
 
 		for ( int x = 0; x < image.width; x++ )
@@ -995,7 +1173,7 @@ void writeObjectImages( std::vector<Image> &images, const char *filename, const
 		}
 
 #if DEBUG_OUTPUT
-		std::cout << "Saving BMP..." << "\n";
+		printLine( "Saving BMP..." );
 #endif
 
 		std::string fname(path);
@@ -1007,7 +1185,7 @@ void writeObjectImages( std::vector<Image> &images, const char *filename, const
 		theBMP.write( cc );
 #else // tga
 #if DEBUG_OUTPUT
-		std::cout << "Init TGA of width and height: " << std::to_string(image.width) << " " << std::to_string(image.height) << "\n";
+		printLine( "Init TGA of width and height: ", std::to_string(image.width), " ", std::to_string(image.height) );
 #endif
 
 		// re-order from RGBA -> BGRA for .tga
@@ -1033,7 +1211,8 @@ void writeObjectImages( std::vector<Image> &images, const char *filename, const
 		imageindex++;	
 	}
 
-	std::cout << "Object image writing successful!" << "\n" << "\n";
+	printLine( "Object image writing successful!" );
+	printLine();
 }
 
 // i should have put this in the cmd line...
@@ -1053,1382 +1232,3714 @@ void writeObjectImages( std::vector<Image> &images, const char *filename, const
 #define SPRITES_OBJ 0
 // apply position offsets to vertices? if not, the offset will be written to a .txt
 #define POSITION_OBJ 1
+// sort the faces of every object and track section by material, so each material run gets a single usemtl
+#define SORTED_MATERIALS_OBJ 1
 
-// this is a gigantic disaster, I had no idea what I was doing
-// this would be written way better if I revisited it today (i wish i knew about void type pointers earlier)
-void writeObjects( std::vector<Object> &objects, std::vector<Image> &images, const char *filename, const char *path )
+// psx uvs are in pixels with the origin at the top, transformUVs maps them to 0..1 with the origin
+// at the bottom using the size of their texture
+std::vector<UVTransform> buildUVTransforms( const std::vector<Image> &images )
 {
-#if MERGED_OBJ
-	std::string fname(filename);
-	std::string objname(path);
-	std::string mtlname(path);
-	std::string txtname(path);
-	fname += "model";
-	objname += fname;
-	objname += ".obj";
-	mtlname += fname;
-	mtlname += ".mtl";
-#if !POSITION_OBJ
-	txtname += fname;
-	txtname += "_pos";
-	txtname += ".txt";
-	std::ofstream txt(txtname);
-#endif
+	std::vector<UVTransform> transforms( images.size() );
 
-	std::ofstream obj(objname);
+	for ( size_t i = 0; i < images.size(); i++ )
+	{
+		transforms[i].width = (float)images[i].width;
+		transforms[i].height = (float)images[i].height;
+	}
 
-#if DEBUG_OUTPUT
-	std::cout << "Writing object to OBJ file " << fname << "\n";
-#endif
+	return transforms;
+}
 
-#if MTL_OBJ
-	obj << "mtllib " << filename << "model" << ".mtl" << "\n";
-#endif
+inline void transformUVs( const UV *uv, int count, const UVTransform &transform, std::vector<Vector2> &texcoords )
+{
+	for ( int j = 0; j < count; j++ )
+	{
+		Vector2 vector;
+		vector.u = uv[j].u / transform.width;
+		vector.v = 1 - ( uv[j].v / transform.height );
+		texcoords.push_back( vector );
+	}
+}
 
-	int vertexindex = 0;
-	int vertexcoordindex = 0;
-	int vertexcolorindex = 0;
+//
+// mesh
+//
 
-#endif
+// corner order of the polygons in the OBJ, quads are stored as a 2x2 grid
+#define TRIS_VERTEX0 0
+#define TRIS_VERTEX1 1
+#define TRIS_VERTEX2 2
+#define QUAD_VERTEX0 0
+#define QUAD_VERTEX1 2
+#define QUAD_VERTEX2 3
+#define QUAD_VERTEX3 1
+
+// boost pads are tinted blue
+Color trackFaceColor( const TrackFace &face )
+{
+	Color vertexcolor = int32ToColor( face.color );
 
-#if SPRITES_OBJ
-	std::string sprname(path);
-	sprname += fname;
-	sprname += ".spr";
-	std::ofstream spr(sprname);
-	int sprindex = 0;
-#endif
+	if ( face.flags & BOOST )
+	{
+		vertexcolor.r = 32;
+		vertexcolor.g = 32;
+		vertexcolor.b = 255;
+	}
 
-	for ( size_t o = 0; o < objects.size(); o++ )
+	return vertexcolor;
+}
+
+// adds a triangle fan to the primitive of its texture, the corners are in .obj order
+void addMeshFace( Mesh &mesh, std::vector<int> &primitiveOf, int texture, const MeshVertex *corners, int count )
+{
+	size_t slot = texture + 1;
+	if ( slot >= primitiveOf.size() )
+		primitiveOf.resize( slot + 1, -1 );
+
+	if ( primitiveOf[slot] < 0 )
 	{
-		std::string name(objects[o].header.name);
-		name += "_";
-		name += std::to_string(o);
+		primitiveOf[slot] = (int)mesh.primitives.size();
+		mesh.primitives.push_back( MeshPrimitive() );
+		mesh.primitives.back().texture = texture;
+	}
 
-#if !MERGED_OBJ
-		std::string fname(filename);
-		std::string objname(path);
-		std::string mtlname(path);
-		std::string txtname(path);
-		fname += name;
-		objname += fname;
-		objname += ".obj";
-		mtlname += fname;
-		mtlname += ".mtl";
-#if !POSITION_OBJ
-		txtname += fname;
-		txtname += "_pos";
-		txtname += ".txt";
-		std::ofstream txt(txtname);
-#endif
-		std::ofstream obj(objname);
-		obj << "mtllib " << mtlname << "\n";
+	std::vector<uint32_t> &indices = mesh.primitives[primitiveOf[slot]].indices;
+	uint32_t first = (uint32_t)mesh.vertices.size();
 
-		int vertexindex = 0;
-		int vertexcoordindex = 0;
-		int vertexcolorindex = 0;
+	mesh.vertices.insert( mesh.vertices.end(), corners, corners + count );
+	for ( int i = 2; i < count; i++ )
+	{
+		indices.push_back( first );
+		indices.push_back( first + i - 1 );
+		indices.push_back( first + i );
+	}
+}
 
-#if DEBUG_OUTPUT
-		std::cout << "Writing object to OBJ file " << fname << "\n";
-#endif
-#endif
+MeshVertex meshVertex( float x, float y, float z, float u, float v, Color color )
+{
+	MeshVertex vertex;
+	vertex.position[0] = x;
+	vertex.position[1] = y;
+	vertex.position[2] = z;
+	vertex.uv[0] = u;
+	vertex.uv[1] = v;
+	vertex.color[0] = (uint8_t)color.r;
+	vertex.color[1] = (uint8_t)color.g;
+	vertex.color[2] = (uint8_t)color.b;
+	vertex.color[3] = 255;
+	return vertex;
+}
 
-		// DEBUGDBEUG
-#if 0
-		if (!strncmp(objects[o].header.name, "wall_b6_1", 9))
-		{
-		}
-#elif 0
-		if ( o == 73 )
-		{
-		}
-		else
-		{
-			continue;
-		}
-#endif
+// positions are made relative to the mesh translation
+void addTrackFace( Mesh &mesh, std::vector<int> &primitiveOf, const Track &theTrack, const TrackFace &face )
+{
+	Color color = trackFaceColor( face );
+	float flipx = ( face.flags & FLIP ) ? 1.0f : 0.0f;
 
-		obj << "o " << name << "\n";
+	// same corners and uvs as the .obj, v flipped for the top left origin
+	const float u[4] = { 1 - flipx, flipx, flipx, 1 - flipx };
+	const float v[4] = { 1, 1, 0, 0 };
 
-#if DEBUG_OBJ
-		int d_polygons0x00 = 0;
-		int d_polygons0x01 = 0;
-		int d_polygons0x02 = 0;
-		int d_polygons0x03 = 0;
-		int d_polygons0x04 = 0;
-		int d_polygons0x05 = 0;
-		int d_polygons0x06 = 0;
-		int d_polygons0x07 = 0;
-		int d_polygons0x08 = 0;
-		int d_polygons0x0A = 0;
-		int d_polygons0x0B = 0;
+	MeshVertex corners[4];
 
-		for ( size_t p = 0; p < objects[o].polygons.size(); p++ )
-		{
-			if ( objects[o].polygons[p].type == UNKNOWN_00 )
-				d_polygons0x00++;
-			else if ( objects[o].polygons[p].type == FLAT_TRIS_FACE_COLOR )
-				d_polygons0x01++;
-			else if ( objects[o].polygons[p].type == TEXTURED_TRIS_FACE_COLOR )
-				d_polygons0x02++;
-			else if ( objects[o].polygons[p].type == FLAT_QUAD_FACE_COLOR )
-				d_polygons0x03++;
-			else if ( objects[o].polygons[p].type == TEXTURED_QUAD_FACE_COLOR )
-				d_polygons0x04++;
-			else if ( objects[o].polygons[p].type == FLAT_TRIS_VERTEX_COLOR )
-				d_polygons0x05++;
-			else if ( objects[o].polygons[p].type == TEXTURED_TRIS_VERTEX_COLOR )
-				d_polygons0x06++;
-			else if ( objects[o].polygons[p].type == FLAT_QUAD_VERTEX_COLOR )
-				d_polygons0x07++;
-			else if ( objects[o].polygons[p].type == TEXTURED_QUAD_VERTEX_COLOR )
-				d_polygons0x08++;
-			else if ( objects[o].polygons[p].type == SPRITE_TOP_ANCHOR )
-				d_polygons0x0A++;
-			else if ( objects[o].polygons[p].type == SPRITE_BOTTOM_ANCHOR )
-				d_polygons0x0B++;
-		}
-		obj << "# HEADER POLYGON COUNT : " << std::to_string(objects[o].header.polygonCount) << "\n";
-		obj << "# HEADER VERTEX COUNT : " << std::to_string(objects[o].header.vertexCount) << "\n";
-		obj << "# ACTUAL POLYGON COUNT : " << std::to_string(objects[o].polygons.size()) << "\n";
-		obj << "# ACTUAL VERTEX COUNT : " << std::to_string(objects[o].vertices.size()) << "\n";
-		obj << "# POLYGONS 0x00 : " << std::to_string(d_polygons0x00) << "\n";
-		obj << "# POLYGONS 0x01 : " << std::to_string(d_polygons0x01) << "\n";
-		obj << "# POLYGONS 0x02 : " << std::to_string(d_polygons0x02) << "\n";
-		obj << "# POLYGONS 0x03 : " << std::to_string(d_polygons0x03) << "\n";
-		obj << "# POLYGONS 0x04 : " << std::to_string(d_polygons0x04) << "\n";
-		obj << "# POLYGONS 0x05 : " << std::to_string(d_polygons0x05) << "\n";
-		obj << "# POLYGONS 0x06 : " << std::to_string(d_polygons0x06) << "\n";
-		obj << "# POLYGONS 0x07 : " << std::to_string(d_polygons0x07) << "\n";
-		obj << "# POLYGONS 0x08 : " << std::to_string(d_polygons0x08) << "\n";
-		obj << "# POLYGONS 0x0A : " << std::to_string(d_polygons0x0A) << "\n";
-		obj << "# POLYGONS 0x0B : " << std::to_string(d_polygons0x0B) << "\n";
-#endif
+	for ( int k = 0; k < 4; k++ )
+	{
+		int index = face.indices[3 - k];
+		if ( index < 0 || index >= (int)theTrack.vertices.size() )
+			return;
 
-		std::vector<Vector2> vertextexcoords;
-		std::vector<Color> vertexcolors;
+		const TrackVertex &vertex = theTrack.vertices[index];
+		corners[k] = meshVertex( vertex.x - mesh.translation.x, vertex.y - mesh.translation.y, vertex.z - mesh.translation.z, u[k], v[k], color );
+	}
 
-		int currentvertexindex = vertexindex;
-		int currentvertexcoordindex = vertexcoordindex;
-		int currentvertexcolorindex = vertexcolorindex;
+	addMeshFace( mesh, primitiveOf, face.tile < theTrack.images.size() ? face.tile : -1, corners, 4 );
+}
 
-#if DEBUG_OUTPUT
-		std::cout << "Offseting vertices..." << "\n";
-#endif
+Mesh buildTrackMesh( const Track &theTrack )
+{
+	Mesh mesh;
+	mesh.name = "track";
+	mesh.translation = { 0, 0, 0 };
 
-		// correct the orientation of vertices
-#if 0
-		for ( size_t i = 0; i < objects[o].vertices.size(); i++ )
-			objects[o].vertices[i].y *= -1;
-			objects[o].vertices[i].z *= -1;
-		}
-#endif
+	std::vector<int> primitiveOf;
 
-#if POSITION_OBJ
-		// offset vertices to position
-		for ( size_t i = 0; i < objects[o].vertices.size(); i++ )
+	for ( size_t i = 0; i < theTrack.faces.size(); i++ )
+		addTrackFace( mesh, primitiveOf, theTrack, theTrack.faces[i] );
+
+	return mesh;
+}
+
+// one mesh per run of sectionsPerChunk sections, around the position of its first section
+// faces outside every section are left out
+std::vector<Mesh> buildTrackChunkMeshes( const Track &theTrack, size_t sectionsPerChunk )
+{
+	sectionsPerChunk = std::max( sectionsPerChunk, (size_t)1 );
+	std::vector<Mesh> meshes( ( theTrack.sections.size() + sectionsPerChunk - 1 ) / sectionsPerChunk );
+
+	for ( size_t c = 0; c < meshes.size(); c++ )
+	{
+		const TrackSection &first = theTrack.sections[c * sectionsPerChunk];
+		Mesh &mesh = meshes[c];
+		mesh.name = "chunk_" + std::to_string( c );
+		mesh.translation = { (float)first.x, (float)first.y, (float)first.z };
+
+		std::vector<int> primitiveOf;
+
+		size_t end = std::min( ( c + 1 ) * sectionsPerChunk, theTrack.sections.size() );
+		for ( size_t s = c * sectionsPerChunk; s < end; s++ )
 		{
-			objects[o].vertices[i].x += objects[o].header.position.x;
-			objects[o].vertices[i].y += objects[o].header.position.y;
-			objects[o].vertices[i].z += objects[o].header.position.z;
+			const TrackSection &section = theTrack.sections[s];
+			size_t last = std::min( (size_t)section.firstFace + section.numFaces, theTrack.faces.size() );
+			for ( size_t i = section.firstFace; i < last; i++ )
+				addTrackFace( mesh, primitiveOf, theTrack, theTrack.faces[i] );
 		}
-#else
-		// write .txt of what position each object is at. I use this for the port to source engine
-		txt << objects[o].header.position.x << " " << objects[o].header.position.y << " " << objects[o].header.position.z << "\n";
-		txt.close();
-#endif
+	}
 
-#if DEBUG_OUTPUT
-		std::cout << "Writing vertices..." << "\n";
-#endif
+	return meshes;
+}
 
-#if DEBUG_OBJ
-			obj << "# VERTEXINDEX_START " << std::to_string(vertexindex) << "\n";
-			obj << "# VERTEXINDEX_END " << std::to_string(vertexindex + objects[o].vertices.size()) << "\n";
-#endif
+// one polygon of an object, colors either per face or per corner
+void addObjectFace( Mesh &mesh, std::vector<int> &primitiveOf, const Object &object, const std::vector<UVTransform> &uvTransforms,
+	const uint16_t *indices, int count, int texture, const UV *uv, const uint32_t *colors, bool bVertexColors )
+{
+	const int trisCorners[3] = { TRIS_VERTEX0, TRIS_VERTEX1, TRIS_VERTEX2 };
+	const int quadCorners[4] = { QUAD_VERTEX0, QUAD_VERTEX1, QUAD_VERTEX2, QUAD_VERTEX3 };
+	const int *order = count == 3 ? trisCorners : quadCorners;
 
-		// write vertices
-		for ( size_t i = 0; i < objects[o].vertices.size(); i++ )
+	if ( texture >= (int)uvTransforms.size() )
+		texture = -1;
+
+	MeshVertex corners[4];
+
+	for ( int k = 0; k < count; k++ )
+	{
+		int corner = order[k];
+		if ( indices[corner] >= object.vertices.size() )
+			return;
+
+		const Vertex32 &vertex = object.vertices[indices[corner]];
+		Color color = int32ToColor( bVertexColors ? colors[corner] : colors[0] );
+
+		float u = 0, v = 0;
+		if ( texture >= 0 )
 		{
+			const UVTransform &transform = uvTransforms[texture];
+			u = uv[corner].u / transform.width;
+			v = uv[corner].v / transform.height;
+		}
 
-			obj << "v " 
-				<< std::to_string( objects[o].vertices[i].x )
-				<< " " 
-				<< std::to_string( objects[o].vertices[i].y )
-				<< " "
-				<< std::to_string( objects[o].vertices[i].z )
-				<< "\n";
+		corners[k] = meshVertex( (float)vertex.x, (float)vertex.y, (float)vertex.z, u, v, color );
+	}
 
-			vertexindex++;
+	addMeshFace( mesh, primitiveOf, texture, corners, count );
+}
+
+// vertices stay relative to the object, its position becomes the translation
+Mesh buildObjectMesh( const Object &object, const std::vector<UVTransform> &uvTransforms )
+{
+	Mesh mesh;
+	mesh.name = object.header.name;
+	mesh.name += "_";
+	mesh.name += std::to_string( object.index );
+	mesh.translation = { (float)object.header.position.x, (float)object.header.position.y, (float)object.header.position.z };
+
+	std::vector<int> primitiveOf;
+
+	for ( size_t p = 0; p < object.polygons.size(); p++ )
+	{
+		const PolygonBase &polygon = object.polygons[p];
+
+		switch ( polygon.type )
+		{
+			case FLAT_TRIS_FACE_COLOR:
+				addObjectFace( mesh, primitiveOf, object, uvTransforms, polygon.polygon0x01.indices, 3, -1, NULL, &polygon.polygon0x01.color, false );
+				break;
+			case TEXTURED_TRIS_FACE_COLOR:
+				addObjectFace( mesh, primitiveOf, object, uvTransforms, polygon.polygon0x02.indices, 3, polygon.polygon0x02.texture, polygon.polygon0x02.uv, &polygon.polygon0x02.color, false );
+				break;
+			case FLAT_QUAD_FACE_COLOR:
+				addObjectFace( mesh, primitiveOf, object, uvTransforms, polygon.polygon0x03.indices, 4, -1, NULL, &polygon.polygon0x03.color, false );
+				break;
+			case TEXTURED_QUAD_FACE_COLOR:
+				addObjectFace( mesh, primitiveOf, object, uvTransforms, polygon.polygon0x04.indices, 4, polygon.polygon0x04.texture, polygon.polygon0x04.uv, &polygon.polygon0x04.color, false );
+				break;
+			case FLAT_TRIS_VERTEX_COLOR:
+				addObjectFace( mesh, primitiveOf, object, uvTransforms, polygon.polygon0x05.indices, 3, -1, NULL, polygon.polygon0x05.colors, true );
+				break;
+			case TEXTURED_TRIS_VERTEX_COLOR:
+				addObjectFace( mesh, primitiveOf, object, uvTransforms, polygon.polygon0x06.indices, 3, polygon.polygon0x06.texture, polygon.polygon0x06.uv, polygon.polygon0x06.colors, true );
+				break;
+			case FLAT_QUAD_VERTEX_COLOR:
+				addObjectFace( mesh, primitiveOf, object, uvTransforms, polygon.polygon0x07.indices, 4, -1, NULL, polygon.polygon0x07.colors, true );
+				break;
+			case TEXTURED_QUAD_VERTEX_COLOR:
+				addObjectFace( mesh, primitiveOf, object, uvTransforms, polygon.polygon0x08.indices, 4, polygon.polygon0x08.texture, polygon.polygon0x08.uv, polygon.polygon0x08.colors, true );
+				break;
+			default:
+				// sprites are not meshes
+				break;
 		}
+	}
 
-#if DEBUG_OUTPUT
-		std::cout << "Reading texcoords..." << "\n";
-#endif
+	return mesh;
+}
 
-		// read tex coords from polygons
-		for ( size_t p = 0; p < objects[o].polygons.size(); p++ )
+// first vertex, texcoord, vertex color and sprite of an object in the merged .obj
+struct ObjIndexBase
+{
+	int vertex = 0;
+	int texcoord = 0;
+	int color = 0;
+	int sprite = 0;
+};
+
+struct MeshVertexHash
+{
+	size_t operator()( const MeshVertex &vertex ) const
+	{
+		// fnv-1a over the raw bytes, MeshVertex has no padding
+		const uint8_t *bytes = (const uint8_t*)&vertex;
+		uint64_t hash = 14695981039346656037ull;
+		for ( size_t i = 0; i < sizeof(MeshVertex); i++ )
+			hash = ( hash ^ bytes[i] ) * 1099511628211ull;
+		return (size_t)hash;
+	}
+};
+
+struct MeshVertexEqual
+{
+	bool operator()( const MeshVertex &a, const MeshVertex &b ) const
+	{
+		return memcmp( &a, &b, sizeof(MeshVertex) ) == 0;
+	}
+};
+
+// merges vertices with the same position, uv and color, returns the vertex count from before
+size_t weldMesh( Mesh &mesh )
+{
+	static_assert( sizeof(MeshVertex) == 24, "MeshVertex must not have padding, it is hashed as bytes" );
+
+	std::unordered_map<MeshVertex, uint32_t, MeshVertexHash, MeshVertexEqual> unique;
+	unique.reserve( mesh.vertices.size() );
+
+	std::vector<uint32_t> remap( mesh.vertices.size() );
+	std::vector<MeshVertex> vertices;
+
+	for ( size_t i = 0; i < mesh.vertices.size(); i++ )
+	{
+		auto result = unique.emplace( mesh.vertices[i], (uint32_t)vertices.size() );
+		if ( result.second )
+			vertices.push_back( mesh.vertices[i] );
+		remap[i] = result.first->second;
+	}
+
+	for ( size_t p = 0; p < mesh.primitives.size(); p++ )
+	{
+		for ( size_t i = 0; i < mesh.primitives[p].indices.size(); i++ )
+			mesh.primitives[p].indices[i] = remap[mesh.primitives[p].indices[i]];
+	}
+
+	size_t before = mesh.vertices.size();
+	mesh.vertices.swap( vertices );
+	return before;
+}
+
+void printWeldStats( const std::string &what, size_t before, size_t after )
+{
+	printLine( what, " welded from ", before, " to ", after, " vertices" );
+}
+
+// vertex cache optimisation, after Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+// the triangles of each primitive are reordered for an lru cache of this size
+#define VERTEX_CACHE_SIZE 32
+// acmr is measured on a fifo cache like most hardware has
+#define ACMR_CACHE_SIZE 16
+
+float vertexCacheScore( int cachePosition, int remaining )
+{
+	if ( remaining == 0 )
+		return -1.0f;
+
+	float score = 0.0f;
+	if ( cachePosition >= 0 )
+	{
+		// the vertices of the last triangle get a fixed score, so it doesn't matter which edge comes next
+		if ( cachePosition < 3 )
+			score = 0.75f;
+		else
+			score = powf( 1.0f - ( cachePosition - 3 ) * ( 1.0f / ( VERTEX_CACHE_SIZE - 3 ) ), 1.5f );
+	}
+
+	// vertices with few triangles left are finished off first
+	return score + 2.0f * powf( (float)remaining, -0.5f );
+}
+
+void optimizeVertexCache( std::vector<uint32_t> &indices, size_t vertexCount )
+{
+	size_t triCount = indices.size() / 3;
+	if ( triCount < 2 )
+		return;
+
+	// triangles of every vertex, the first remaining[v] entries are the ones not emitted yet
+	std::vector<int> remaining( vertexCount, 0 );
+	std::vector<uint32_t> offsets( vertexCount + 1, 0 );
+	for ( size_t i = 0; i < triCount * 3; i++ )
+		remaining[indices[i]]++;
+	for ( size_t v = 0; v < vertexCount; v++ )
+		offsets[v + 1] = offsets[v] + remaining[v];
+
+	std::vector<uint32_t> vertexTris( triCount * 3 );
+	std::vector<uint32_t> fill( offsets.begin(), offsets.end() - 1 );
+	for ( size_t i = 0; i < triCount * 3; i++ )
+		vertexTris[fill[indices[i]]++] = (uint32_t)( i / 3 );
+
+	std::vector<int> cachePosition( vertexCount, -1 );
+	std::vector<float> vertexScore( vertexCount );
+	for ( size_t v = 0; v < vertexCount; v++ )
+		vertexScore[v] = vertexCacheScore( -1, remaining[v] );
+
+	std::vector<float> triScore( triCount );
+	std::vector<bool> bAdded( triCount, false );
+	for ( size_t t = 0; t < triCount; t++ )
+		triScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+	std::vector<uint32_t> cache, newCache;
+	std::vector<uint32_t> out;
+	out.reserve( triCount * 3 );
+
+	size_t scan = 0;
+	int best = -1;
+	while ( out.size() < triCount * 3 )
+	{
+		// nothing in the cache touches a triangle that is left, take the best one of all
+		if ( best < 0 )
 		{
-			if ( objects[o].polygons[p].type == TEXTURED_TRIS_FACE_COLOR )
-			{
-				if ( images.size() > 0 )
-				{
-					Image image = images.at(objects[o].polygons[p].polygon0x02.texture);
-					for ( int j = 0; j < 3; j++ )
-					{
-						UV uv = objects[o].polygons[p].polygon0x02.uv[j];
-						Vector2 vector;
-						vector.u = (float)uv.u;
-						vector.v = (float)uv.v;
-						vector.u = vector.u / image.height;
-						vector.v = 1 - ( vector.v / image.width);
-						// rotate by -90 degrees to fix orientation
-						Vector2 finalvector = vector;
-						finalvector.u = vector.v;
-						finalvector.v = 1 - vector.u;
-						// flip x and y
-						finalvector.u = 1 - finalvector.u;
-						finalvector.v = 1 - finalvector.v;
-						// wow...
-						finalvector.v = 1 - finalvector.v;
-
-						vertextexcoords.push_back(finalvector);
-						vertexcoordindex++;
-					}
-				}
-			}
-			if ( objects[o].polygons[p].type == TEXTURED_QUAD_FACE_COLOR )
-			{
-				if ( images.size() > 0 )
-				{
-					Image image = images.at(objects[o].polygons[p].polygon0x04.texture);
-					for ( int j = 0; j < 4; j++ )
-					{
-						UV uv = objects[o].polygons[p].polygon0x04.uv[j];
-						Vector2 vector;
-						vector.u = (float)uv.u;
-						vector.v = (float)uv.v;
-						vector.u = vector.u / image.height;
-						vector.v = 1 - ( vector.v / image.width);
-						// rotate by 90 degrees to fix orientation
-						Vector2 finalvector = vector;
-						finalvector.u = vector.v;
-						finalvector.v = 1 - vector.u;
-						// flip x and y
-						finalvector.u = 1 - finalvector.u;
-						finalvector.v = 1 - finalvector.v;
-						// wow...
-						finalvector.v = 1 - finalvector.v;
-
-						vertextexcoords.push_back(finalvector);
-						vertexcoordindex++;
-					}
-				}
-			}
-			if ( objects[o].polygons[p].type == TEXTURED_TRIS_VERTEX_COLOR )
+			while ( bAdded[scan] )
+				scan++;
+			best = (int)scan;
+			for ( size_t t = scan + 1; t < triCount; t++ )
 			{
-				if ( images.size() > 0 )
-				{
-					Image image = images.at(objects[o].polygons[p].polygon0x06.texture);
-					for ( int j = 0; j < 3; j++ )
-					{
-						UV uv = objects[o].polygons[p].polygon0x06.uv[j];
-						Vector2 vector;
-						vector.u = (float)uv.u;
-						vector.v = (float)uv.v;
-						vector.u = vector.u / image.height;
-						vector.v = 1 - ( vector.v / image.width);
-						// rotate by 90 degrees to fix orientation
-						Vector2 finalvector = vector;
-						finalvector.u = vector.v;
-						finalvector.v = 1 - vector.u;
-						// flip x and y
-						finalvector.u = 1 - finalvector.u;
-						finalvector.v = 1 - finalvector.v;
-						// wow...
-						finalvector.v = 1 - finalvector.v;
-
-						vertextexcoords.push_back(finalvector);
-						vertexcoordindex++;
-					}
-				}
-			}
-			if ( objects[o].polygons[p].type == TEXTURED_QUAD_VERTEX_COLOR )
-			{
-				if ( images.size() > 0 )
-				{
-					Image image = images.at(objects[o].polygons[p].polygon0x08.texture);
-					for ( int j = 0; j < 4; j++ )
-					{
-						UV uv = objects[o].polygons[p].polygon0x08.uv[j];
-						Vector2 vector;
-						vector.u = (float)uv.u;
-						vector.v = (float)uv.v;
-						vector.u = vector.u / image.height;
-						vector.v = 1 - ( vector.v / image.width);
-						// rotate by 90 degrees to fix orientation
-						Vector2 finalvector = vector;
-						finalvector.u = vector.v;
-						finalvector.v = 1 - vector.u;
-						// flip x and y
-						finalvector.u = 1 - finalvector.u;
-						finalvector.v = 1 - finalvector.v;
-						// wow...
-						finalvector.v = 1 - finalvector.v;
-
-						vertextexcoords.push_back(finalvector);
-						vertexcoordindex++;
-					}
-				}
+				if ( !bAdded[t] && triScore[t] > triScore[best] )
+					best = (int)t;
 			}
 		}
 
-#if DEBUG_OUTPUT
-		std::cout << "Reading vertexcolors..." << "\n";
-#endif
+		const uint32_t *tri = &indices[best * 3];
+		bAdded[best] = true;
+		out.insert( out.end(), tri, tri + 3 );
 
-		// read vertex colors from polygons
-		for ( size_t p = 0; p < objects[o].polygons.size(); p++ )
+		for ( int k = 0; k < 3; k++ )
 		{
-			if ( objects[o].polygons[p].type == FLAT_TRIS_FACE_COLOR )
-			{
-				Color vertexcolor = int32ToColor( objects[o].polygons[p].polygon0x01.color );
-				vertexcolors.push_back(vertexcolor);
-				vertexcolorindex++;
-			}
-			if ( objects[o].polygons[p].type == TEXTURED_TRIS_FACE_COLOR )
-			{
-				Color vertexcolor = int32ToColor( objects[o].polygons[p].polygon0x02.color );
-				vertexcolors.push_back(vertexcolor);
-				vertexcolorindex++;
-			}
-			if ( objects[o].polygons[p].type == FLAT_QUAD_FACE_COLOR )
-			{
-				Color vertexcolor = int32ToColor( objects[o].polygons[p].polygon0x03.color );
-				vertexcolors.push_back(vertexcolor);
-				vertexcolorindex++;
-			}
-			if ( objects[o].polygons[p].type == TEXTURED_QUAD_FACE_COLOR )
-			{
-				Color vertexcolor = int32ToColor( objects[o].polygons[p].polygon0x04.color );
-				vertexcolors.push_back(vertexcolor);
-				vertexcolorindex++;
-			}
-			if ( objects[o].polygons[p].type == FLAT_TRIS_VERTEX_COLOR )
-			{
-				for ( int j = 0; j < 3; j++ )
-				{
-					Color vertexcolor = int32ToColor( objects[o].polygons[p].polygon0x05.colors[j] );
-					vertexcolors.push_back(vertexcolor);
-					vertexcolorindex++;
-				}
-			}
-			if ( objects[o].polygons[p].type == TEXTURED_TRIS_VERTEX_COLOR )
-			{
-				for ( int j = 0; j < 3; j++ )
-				{
-					Color vertexcolor = int32ToColor( objects[o].polygons[p].polygon0x06.colors[j] );
-					vertexcolors.push_back(vertexcolor);
-					vertexcolorindex++;
-				}
-			}
-			if ( objects[o].polygons[p].type == FLAT_QUAD_VERTEX_COLOR )
-			{
-				for ( int j = 0; j < 4; j++ )
-				{
-					Color vertexcolor = int32ToColor( objects[o].polygons[p].polygon0x07.colors[j] );
-					vertexcolors.push_back(vertexcolor);
-					vertexcolorindex++;
-				}
-			}
-			if ( objects[o].polygons[p].type == TEXTURED_QUAD_VERTEX_COLOR )
+			uint32_t v = tri[k];
+			uint32_t *list = &vertexTris[offsets[v]];
+			for ( int i = 0; i < remaining[v]; i++ )
 			{
-				for ( int j = 0; j < 4; j++ )
+				if ( list[i] == (uint32_t)best )
 				{
-					Color vertexcolor = int32ToColor( objects[o].polygons[p].polygon0x08.colors[j] );
-					vertexcolors.push_back(vertexcolor);
-					vertexcolorindex++;
+					std::swap( list[i], list[remaining[v] - 1] );
+					break;
 				}
 			}
+			remaining[v]--;
 		}
 
-#if DEBUG_OBJ
-		obj << "# VERTEXuvINDEX_START " << std::to_string(currentvertexcoordindex) << "\n";
-		obj << "# VERTEXuvINDEX_END " << std::to_string(currentvertexcoordindex + vertextexcoords.size()) << "\n";
-#endif
-
-#if DEBUG_OUTPUT
-		std::cout << "Writing texcoords..." << "\n";
-#endif
+		// the triangle moves to the front of the lru, the rest shifts back
+		newCache.assign( tri, tri + 3 );
+		for ( size_t i = 0; i < cache.size(); i++ )
+		{
+			if ( cache[i] != tri[0] && cache[i] != tri[1] && cache[i] != tri[2] )
+				newCache.push_back( cache[i] );
+		}
+		cache.swap( newCache );
 
-		// write out the vertex texcoords
-		for ( size_t i = 0; i < vertextexcoords.size(); i++ )
+		for ( size_t i = 0; i < cache.size(); i++ )
 		{
+			cachePosition[cache[i]] = i < VERTEX_CACHE_SIZE ? (int)i : -1;
+			vertexScore[cache[i]] = vertexCacheScore( cachePosition[cache[i]], remaining[cache[i]] );
+		}
 
-			obj << "vt " 
-				<< std::to_string(vertextexcoords[i].u) 
-				<< " " 
-				<< std::to_string(vertextexcoords[i].v) 
-				<< "\n";
+		// only the triangles around the cached vertices changed their score
+		best = -1;
+		for ( size_t i = 0; i < cache.size(); i++ )
+		{
+			uint32_t v = cache[i];
+			for ( int j = 0; j < remaining[v]; j++ )
+			{
+				uint32_t t = vertexTris[offsets[v] + j];
+				triScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+				if ( best < 0 || triScore[t] > triScore[best] )
+					best = (int)t;
+			}
 		}
 
-#if DEBUG_OUTPUT
-		std::cout << "Writing vertex colors..." << "\n";
-#endif
+		if ( cache.size() > VERTEX_CACHE_SIZE )
+			cache.resize( VERTEX_CACHE_SIZE );
+	}
 
-#if DEBUG_OBJ
-			obj << "# VERTEXCOLORINDEX_START " << std::to_string(currentvertexcolorindex) << "\n";
-			obj << "# VERTEXCOLORINDEX_END " << std::to_string(currentvertexcolorindex + vertexcolors.size()) << "\n";
-#endif
+	indices.swap( out );
+}
+
+// renumbers the vertices in the order the triangles first use them, so fetches walk the buffer forwards
+void optimizeVertexFetch( Mesh &mesh )
+{
+	std::vector<uint32_t> remap( mesh.vertices.size(), UINT32_MAX );
+	std::vector<MeshVertex> vertices;
+	vertices.reserve( mesh.vertices.size() );
+
+	for ( size_t p = 0; p < mesh.primitives.size(); p++ )
+	{
+		std::vector<uint32_t> &indices = mesh.primitives[p].indices;
+		for ( size_t i = 0; i < indices.size(); i++ )
+		{
+			if ( remap[indices[i]] == UINT32_MAX )
+			{
+				remap[indices[i]] = (uint32_t)vertices.size();
+				vertices.push_back( mesh.vertices[indices[i]] );
+			}
+			indices[i] = remap[indices[i]];
+		}
+	}
+
+	mesh.vertices.swap( vertices );
+}
+
+// vertex transforms of a mesh drawn through a fifo cache
+size_t vertexCacheMisses( const Mesh &mesh )
+{
+	std::vector<size_t> stamp( mesh.vertices.size(), 0 );
+	size_t time = ACMR_CACHE_SIZE + 1;
+	size_t misses = 0;
+
+	for ( size_t p = 0; p < mesh.primitives.size(); p++ )
+	{
+		const std::vector<uint32_t> &indices = mesh.primitives[p].indices;
+		for ( size_t i = 0; i < indices.size(); i++ )
+		{
+			if ( time - stamp[indices[i]] > ACMR_CACHE_SIZE )
+			{
+				stamp[indices[i]] = time++;
+				misses++;
+			}
+		}
+	}
+	return misses;
+}
+
+void optimizeMesh( Mesh &mesh )
+{
+	for ( size_t p = 0; p < mesh.primitives.size(); p++ )
+		optimizeVertexCache( mesh.primitives[p].indices, mesh.vertices.size() );
+	optimizeVertexFetch( mesh );
+}
+
+void printObjStreamStats( const std::string &what, size_t positions, size_t uvs, size_t colors )
+{
+	printLine( what, " .obj streams: ", positions, " v, ", uvs, " vt, ", colors, " #vcolor" );
+}
+
+// a mesh split into the streams .obj indexes separately, each deduplicated on its own
+struct ObjStreams
+{
+	std::vector<uint32_t> positionOf;	// per mesh vertex, index into the unique lists
+	std::vector<uint32_t> uvOf;
+	std::vector<uint32_t> colorOf;
+	std::vector<uint32_t> positions;	// per unique entry, the mesh vertex it comes from
+	std::vector<uint32_t> uvs;
+	std::vector<uint32_t> colors;
+};
+
+ObjStreams splitObjStreams( const Mesh &mesh )
+{
+	ObjStreams streams;
+	streams.positionOf.resize( mesh.vertices.size() );
+	streams.uvOf.resize( mesh.vertices.size() );
+	streams.colorOf.resize( mesh.vertices.size() );
+
+	std::map<std::tuple<float, float, float>, uint32_t> positions;
+	std::unordered_map<uint64_t, uint32_t> uvs;
+	std::unordered_map<uint32_t, uint32_t> colors;
+
+	for ( size_t i = 0; i < mesh.vertices.size(); i++ )
+	{
+		const MeshVertex &vertex = mesh.vertices[i];
+
+		auto position = positions.emplace( std::make_tuple( vertex.position[0], vertex.position[1], vertex.position[2] ), (uint32_t)streams.positions.size() );
+		if ( position.second )
+			streams.positions.push_back( (uint32_t)i );
+		streams.positionOf[i] = position.first->second;
+
+		uint64_t uvKey;
+		memcpy( &uvKey, vertex.uv, sizeof(uvKey) );
+		auto uv = uvs.emplace( uvKey, (uint32_t)streams.uvs.size() );
+		if ( uv.second )
+			streams.uvs.push_back( (uint32_t)i );
+		streams.uvOf[i] = uv.first->second;
+
+		uint32_t colorKey = vertex.color[0] | ( vertex.color[1] << 8 ) | ( vertex.color[2] << 16 );
+		auto color = colors.emplace( colorKey, (uint32_t)streams.colors.size() );
+		if ( color.second )
+			streams.colors.push_back( (uint32_t)i );
+		streams.colorOf[i] = color.first->second;
+	}
+
+	return streams;
+}
+
+// writes a welded mesh with the streams from splitObjStreams, base is where each stream starts in the file
+void writeMeshOBJ( ObjWriter &obj, const Mesh &mesh, const ObjStreams &streams, const char *materialPrefix, bool bTranslate, const ObjIndexBase &base )
+{
+	float tx = bTranslate ? mesh.translation.x : 0;
+	float ty = bTranslate ? mesh.translation.y : 0;
+	float tz = bTranslate ? mesh.translation.z : 0;
+
+	// positions are whole psx units
+	for ( size_t i = 0; i < streams.positions.size(); i++ )
+	{
+		const MeshVertex &vertex = mesh.vertices[streams.positions[i]];
+		obj << "v " << lroundf( vertex.position[0] + tx ) << " " << lroundf( vertex.position[1] + ty ) << " " << lroundf( vertex.position[2] + tz ) << "\n";
+	}
+
+	// back to the bottom left origin of .obj
+	for ( size_t i = 0; i < streams.uvs.size(); i++ )
+	{
+		const MeshVertex &vertex = mesh.vertices[streams.uvs[i]];
+		obj << "vt " << vertex.uv[0] << " " << 1 - vertex.uv[1] << "\n";
+	}
+
+	for ( size_t i = 0; i < streams.colors.size(); i++ )
+	{
+		const MeshVertex &vertex = mesh.vertices[streams.colors[i]];
+		obj << "#vcolor " << vertex.color[0] << " " << vertex.color[1] << " " << vertex.color[2] << "\n";
+	}
+
+	obj << "s off" << "\n";
+
+	for ( size_t p = 0; p < mesh.primitives.size(); p++ )
+	{
+		const MeshPrimitive &primitive = mesh.primitives[p];
+		bool bTextured = primitive.texture >= 0;
+
+#if MTL_OBJ
+		if ( bTextured )
+			obj << "usemtl " << materialPrefix << primitive.texture << "\n";
+		else
+			obj << "usemtl dummy" << "\n";
+#endif
+
+		for ( size_t i = 0; i + 2 < primitive.indices.size(); i += 3 )
+		{
+			obj << "f ";
+			for ( int k = 0; k < 3; k++ )
+			{
+				uint32_t index = primitive.indices[i + k];
+				obj << streams.positionOf[index] + 1 + base.vertex << "/";
+				if ( bTextured )
+					obj << streams.uvOf[index] + 1 + base.texcoord << "/" << streams.uvOf[index] + 1 + base.texcoord;
+				else
+					obj << "/";
+				obj << " ";
+			}
+			obj << "\n";
+
+			obj << "#fvcolorindex";
+			for ( int k = 0; k < 3; k++ )
+				obj << " " << streams.colorOf[primitive.indices[i + k]] + 1 + base.color;
+			obj << "\n";
+		}
+	}
+}
+
+// how many of each writeObjects emits for an object, must match what it actually writes
+// what one polygon adds to the .obj lists
+ObjIndexBase countObjPolygon( const PolygonBase &polygon, bool bTextured )
+{
+	ObjIndexBase counts;
+
+	switch ( polygon.type )
+	{
+		case FLAT_TRIS_FACE_COLOR:
+		case FLAT_QUAD_FACE_COLOR:
+			counts.color = 1;
+			break;
+		case TEXTURED_TRIS_FACE_COLOR:
+			counts.color = 1;
+			counts.texcoord = bTextured ? 3 : 0;
+			break;
+		case TEXTURED_QUAD_FACE_COLOR:
+			counts.color = 1;
+			counts.texcoord = bTextured ? 4 : 0;
+			break;
+		case FLAT_TRIS_VERTEX_COLOR:
+			counts.color = 3;
+			break;
+		case FLAT_QUAD_VERTEX_COLOR:
+			counts.color = 4;
+			break;
+		case TEXTURED_TRIS_VERTEX_COLOR:
+			counts.color = 3;
+			counts.texcoord = bTextured ? 3 : 0;
+			break;
+		case TEXTURED_QUAD_VERTEX_COLOR:
+			counts.color = 4;
+			counts.texcoord = bTextured ? 4 : 0;
+			break;
+		case SPRITE_TOP_ANCHOR:
+		case SPRITE_BOTTOM_ANCHOR:
+			counts.sprite = 1;
+			break;
+		default:
+			break;
+	}
+
+	return counts;
+}
+
+ObjIndexBase countObjIndices( const Object &object, bool bTextured )
+{
+	ObjIndexBase counts;
+	counts.vertex = (int)object.vertices.size();
+
+	for ( size_t p = 0; p < object.polygons.size(); p++ )
+	{
+		ObjIndexBase polygon = countObjPolygon( object.polygons[p], bTextured );
+		counts.texcoord += polygon.texcoord;
+		counts.color += polygon.color;
+		counts.sprite += polygon.sprite;
+	}
+
+	return counts;
+}
+
+// texture of a polygon, -1 for the untextured ones
+int objPolygonMaterial( const PolygonBase &polygon )
+{
+	switch ( polygon.type )
+	{
+		case TEXTURED_TRIS_FACE_COLOR:
+			return polygon.polygon0x02.texture;
+		case TEXTURED_QUAD_FACE_COLOR:
+			return polygon.polygon0x04.texture;
+		case TEXTURED_TRIS_VERTEX_COLOR:
+			return polygon.polygon0x06.texture;
+		case TEXTURED_QUAD_VERTEX_COLOR:
+			return polygon.polygon0x08.texture;
+		default:
+			return -1;
+	}
+}
+
+void writeObjectsMTL( const std::string &mtlname, const char *filename, size_t imageCount )
+{
+#if DEBUG_OUTPUT
+	printText("Writing MTL file ...");
+#endif
+
+	ObjWriter mtl( mtlname, 64 * 1024 );
+
+	for ( size_t i = 0; i < imageCount; i++ )
+	{
+		mtl << "newmtl " << filename << i << "\n";
+		mtl << "map_Kd " << filename << i << ".tga" << "\n" << "\n";
+	}
+
+	mtl << "newmtl dummy" << "\n";
+	mtl << "map_Kd white.tga" << "\n" << "\n";	
+
+#if DEBUG_OUTPUT
+	printText("MTL file written successfully!");
+#endif
+}
+
+// --weld version of writeObjects, writes the already welded meshes (one per object)
+// sprites are not part of the meshes, so no .spr is written
+void writeWeldedObjects( const std::vector<Object> &objects, const std::vector<Image> &images, const std::vector<Mesh> &meshes, const char *filename, const char *path )
+{
+	std::vector<ObjStreams> streams( objects.size() );
+
+	parallelFor( objects.size(), [&]( size_t o )
+	{
+		streams[o] = splitObjStreams( meshes[o] );
+	} );
+
+	size_t positions = 0, uvs = 0, colors = 0;
+	for ( size_t o = 0; o < objects.size(); o++ )
+	{
+		positions += streams[o].positions.size();
+		uvs += streams[o].uvs.size();
+		colors += streams[o].colors.size();
+	}
+	printObjStreamStats( filename, positions, uvs, colors );
+
+	std::string pathname(path);
+
+#if MERGED_OBJ
+	// same as the unwelded writer, count first so the objects can be written in parallel
+	std::vector<ObjIndexBase> bases( objects.size() );
+	for ( size_t o = 1; o < objects.size(); o++ )
+	{
+		bases[o].vertex = bases[o - 1].vertex + (int)streams[o - 1].positions.size();
+		bases[o].texcoord = bases[o - 1].texcoord + (int)streams[o - 1].uvs.size();
+		bases[o].color = bases[o - 1].color + (int)streams[o - 1].colors.size();
+	}
+
+	std::vector<std::unique_ptr<ObjWriter>> buffers( objects.size() );
+	parallelFor( objects.size(), [&]( size_t o )
+	{
+		buffers[o].reset( new ObjWriter( 256 * 1024 ) );
+		*buffers[o] << "o " << meshes[o].name << "\n";
+		writeMeshOBJ( *buffers[o], meshes[o], streams[o], filename, POSITION_OBJ, bases[o] );
+	} );
+
+	ObjWriter obj( pathname + filename + "model.obj" );
+#if MTL_OBJ
+	obj << "mtllib " << filename << "model" << ".mtl" << "\n";
+#endif
+#if !POSITION_OBJ
+	ObjWriter txt( pathname + filename + "model_pos.txt", 64 * 1024 );
+#endif
+
+	for ( size_t o = 0; o < objects.size(); o++ )
+	{
+		obj.write( buffers[o]->buffer.data(), buffers[o]->used );
+		buffers[o].reset();
+#if !POSITION_OBJ
+		txt << objects[o].header.position.x << " " << objects[o].header.position.y << " " << objects[o].header.position.z << "\n";
+#endif
+	}
+
+	writeObjectsMTL( pathname + filename + "model.mtl", filename, images.size() );
+#else
+	parallelFor( objects.size(), [&]( size_t o )
+	{
+		std::string fname( filename );
+		fname += meshes[o].name;
+
+		ObjWriter obj( pathname + fname + ".obj", 256 * 1024 );
+		obj << "mtllib " << pathname << fname << ".mtl" << "\n";
+		obj << "o " << meshes[o].name << "\n";
+		writeMeshOBJ( obj, meshes[o], streams[o], filename, POSITION_OBJ, ObjIndexBase() );
+
+#if !POSITION_OBJ
+		ObjWriter txt( pathname + fname + "_pos.txt", 4 * 1024 );
+		txt << objects[o].header.position.x << " " << objects[o].header.position.y << " " << objects[o].header.position.z << "\n";
+#endif
+
+		writeObjectsMTL( pathname + fname + ".mtl", filename, images.size() );
+	} );
+#endif
+}
+
+// this is a gigantic disaster, I had no idea what I was doing
+// this would be written way better if I revisited it today (i wish i knew about void type pointers earlier)
+void writeObjects( const std::vector<Object> &objects, const std::vector<Image> &images, const std::vector<Mesh> &meshes, const char *filename, const char *path )
+{
+	if ( options.bWeld )
+	{
+		writeWeldedObjects( objects, images, meshes, filename, path );
+		return;
+	}
+
+	std::vector<UVTransform> uvTransforms = buildUVTransforms( images );
+
+#if MERGED_OBJ
+	std::string fname(filename);
+	std::string objname(path);
+	std::string mtlname(path);
+	std::string txtname(path);
+	fname += "model";
+	objname += fname;
+	objname += ".obj";
+	mtlname += fname;
+	mtlname += ".mtl";
+#if !POSITION_OBJ
+	txtname += fname;
+	txtname += "_pos";
+	txtname += ".txt";
+	std::ofstream txt(txtname);
+#endif
+
+	ObjWriter obj(objname);
+
+#if DEBUG_OUTPUT
+	printLine( "Writing object to OBJ file ", fname );
+#endif
+
+#if MTL_OBJ
+	obj << "mtllib " << filename << "model" << ".mtl" << "\n";
+#endif
+#else
+	// the buffer is reused for every object file
+	ObjWriter obj;
+#endif
+
+#if SPRITES_OBJ
+	std::string sprname(path);
+	sprname += fname;
+	sprname += ".spr";
+	ObjWriter spr(sprname);
+#endif
+
+#if MERGED_OBJ
+	// counting pass, fixes where every object starts in the merged index spaces
+	std::vector<ObjIndexBase> bases( objects.size() );
+	for ( size_t o = 1; o < objects.size(); o++ )
+	{
+		ObjIndexBase counts = countObjIndices( objects[o - 1], images.size() > 0 );
+		bases[o].vertex = bases[o - 1].vertex + counts.vertex;
+		bases[o].texcoord = bases[o - 1].texcoord + counts.texcoord;
+		bases[o].color = bases[o - 1].color + counts.color;
+		bases[o].sprite = bases[o - 1].sprite + counts.sprite;
+	}
+
+	// every object is serialised into its own buffer
+	std::vector<std::unique_ptr<ObjWriter>> buffers( objects.size() );
+#if SPRITES_OBJ
+	std::vector<std::unique_ptr<ObjWriter>> sprbuffers( objects.size() );
+#endif
+#endif
+
+	auto writeObject = [&]( size_t o, ObjWriter &obj )
+	{
+#if MERGED_OBJ && SPRITES_OBJ
+		sprbuffers[o].reset( new ObjWriter( 4 * 1024 ) );
+		ObjWriter &spr = *sprbuffers[o];
+		int sprindex = bases[o].sprite;
+#endif
+
+		std::string name(objects[o].header.name);
+		name += "_";
+		name += std::to_string(objects[o].index);
+
+#if !MERGED_OBJ
+		std::string fname(filename);
+		std::string objname(path);
+		std::string mtlname(path);
+		std::string txtname(path);
+		fname += name;
+		objname += fname;
+		objname += ".obj";
+		mtlname += fname;
+		mtlname += ".mtl";
+#if !POSITION_OBJ
+		txtname += fname;
+		txtname += "_pos";
+		txtname += ".txt";
+		std::ofstream txt(txtname);
+#endif
+		obj.open(objname);
+		obj << "mtllib " << mtlname << "\n";
+
+		int vertexindex = 0;
+		int vertexcoordindex = 0;
+		int vertexcolorindex = 0;
+
+#if DEBUG_OUTPUT
+		printLine( "Writing object to OBJ file ", fname );
+#endif
+#else
+		int vertexindex = bases[o].vertex;
+		int vertexcoordindex = bases[o].texcoord;
+		int vertexcolorindex = bases[o].color;
+#endif
+
+		// DEBUGDBEUG
+#if 0
+		if (!strncmp(objects[o].header.name, "wall_b6_1", 9))
+		{
+		}
+#elif 0
+		if ( o == 73 )
+		{
+		}
+		else
+		{
+			return;
+		}
+#endif
+
+		obj << "o " << name << "\n";
+
+#if DEBUG_OBJ
+		int d_polygons0x00 = 0;
+		int d_polygons0x01 = 0;
+		int d_polygons0x02 = 0;
+		int d_polygons0x03 = 0;
+		int d_polygons0x04 = 0;
+		int d_polygons0x05 = 0;
+		int d_polygons0x06 = 0;
+		int d_polygons0x07 = 0;
+		int d_polygons0x08 = 0;
+		int d_polygons0x0A = 0;
+		int d_polygons0x0B = 0;
+
+		for ( size_t p = 0; p < objects[o].polygons.size(); p++ )
+		{
+			if ( objects[o].polygons[p].type == UNKNOWN_00 )
+				d_polygons0x00++;
+			else if ( objects[o].polygons[p].type == FLAT_TRIS_FACE_COLOR )
+				d_polygons0x01++;
+			else if ( objects[o].polygons[p].type == TEXTURED_TRIS_FACE_COLOR )
+				d_polygons0x02++;
+			else if ( objects[o].polygons[p].type == FLAT_QUAD_FACE_COLOR )
+				d_polygons0x03++;
+			else if ( objects[o].polygons[p].type == TEXTURED_QUAD_FACE_COLOR )
+				d_polygons0x04++;
+			else if ( objects[o].polygons[p].type == FLAT_TRIS_VERTEX_COLOR )
+				d_polygons0x05++;
+			else if ( objects[o].polygons[p].type == TEXTURED_TRIS_VERTEX_COLOR )
+				d_polygons0x06++;
+			else if ( objects[o].polygons[p].type == FLAT_QUAD_VERTEX_COLOR )
+				d_polygons0x07++;
+			else if ( objects[o].polygons[p].type == TEXTURED_QUAD_VERTEX_COLOR )
+				d_polygons0x08++;
+			else if ( objects[o].polygons[p].type == SPRITE_TOP_ANCHOR )
+				d_polygons0x0A++;
+			else if ( objects[o].polygons[p].type == SPRITE_BOTTOM_ANCHOR )
+				d_polygons0x0B++;
+		}
+		obj << "# HEADER POLYGON COUNT : " << objects[o].header.polygonCount << "\n";
+		obj << "# HEADER VERTEX COUNT : " << objects[o].header.vertexCount << "\n";
+		obj << "# ACTUAL POLYGON COUNT : " << objects[o].polygons.size() << "\n";
+		obj << "# ACTUAL VERTEX COUNT : " << objects[o].vertices.size() << "\n";
+		obj << "# POLYGONS 0x00 : " << d_polygons0x00 << "\n";
+		obj << "# POLYGONS 0x01 : " << d_polygons0x01 << "\n";
+		obj << "# POLYGONS 0x02 : " << d_polygons0x02 << "\n";
+		obj << "# POLYGONS 0x03 : " << d_polygons0x03 << "\n";
+		obj << "# POLYGONS 0x04 : " << d_polygons0x04 << "\n";
+		obj << "# POLYGONS 0x05 : " << d_polygons0x05 << "\n";
+		obj << "# POLYGONS 0x06 : " << d_polygons0x06 << "\n";
+		obj << "# POLYGONS 0x07 : " << d_polygons0x07 << "\n";
+		obj << "# POLYGONS 0x08 : " << d_polygons0x08 << "\n";
+		obj << "# POLYGONS 0x0A : " << d_polygons0x0A << "\n";
+		obj << "# POLYGONS 0x0B : " << d_polygons0x0B << "\n";
+#endif
+
+		std::vector<Vector2> vertextexcoords;
+		std::vector<Color> vertexcolors;
+
+		int currentvertexindex = vertexindex;
+		int currentvertexcoordindex = vertexcoordindex;
+		int currentvertexcolorindex = vertexcolorindex;
+
+#if DEBUG_OUTPUT
+		printLine( "Offseting vertices..." );
+#endif
+
+		// correct the orientation of vertices
+#if 0
+		for ( size_t i = 0; i < objects[o].vertices.size(); i++ )
+			objects[o].vertices[i].y *= -1;
+			objects[o].vertices[i].z *= -1;
+		}
+#endif
+
+#if POSITION_OBJ
+		// offset vertices to position, done while writing so the objects themselves stay untouched
+		Vector3 offset = objects[o].header.position;
+#else
+		Vector3 offset = { 0, 0, 0 };
+
+#if !MERGED_OBJ
+		// write .txt of what position each object is at. I use this for the port to source engine
+		txt << objects[o].header.position.x << " " << objects[o].header.position.y << " " << objects[o].header.position.z << "\n";
+		txt.close();
+#endif
+#endif
+
+#if DEBUG_OUTPUT
+		printLine( "Writing vertices..." );
+#endif
+
+#if DEBUG_OBJ
+			obj << "# VERTEXINDEX_START " << vertexindex << "\n";
+			obj << "# VERTEXINDEX_END " << vertexindex + objects[o].vertices.size() << "\n";
+#endif
+
+		// write vertices
+		for ( size_t i = 0; i < objects[o].vertices.size(); i++ )
+		{
+
+			obj << "v " 
+				<< objects[o].vertices[i].x + offset.x
+				<< " " 
+				<< objects[o].vertices[i].y + offset.y
+				<< " "
+				<< objects[o].vertices[i].z + offset.z
+				<< "\n";
+
+			vertexindex++;
+		}
+
+#if DEBUG_OUTPUT
+		printLine( "Reading texcoords..." );
+#endif
+
+		// read tex coords from polygons
+		if ( images.size() > 0 )
+		{
+			size_t firsttexcoord = vertextexcoords.size();
+
+			for ( size_t p = 0; p < objects[o].polygons.size(); p++ )
+			{
+				const PolygonBase &polygon = objects[o].polygons[p];
+
+				switch ( polygon.type )
+				{
+					case TEXTURED_TRIS_FACE_COLOR:
+						transformUVs( polygon.polygon0x02.uv, 3, uvTransforms.at( polygon.polygon0x02.texture ), vertextexcoords );
+						break;
+					case TEXTURED_QUAD_FACE_COLOR:
+						transformUVs( polygon.polygon0x04.uv, 4, uvTransforms.at( polygon.polygon0x04.texture ), vertextexcoords );
+						break;
+					case TEXTURED_TRIS_VERTEX_COLOR:
+						transformUVs( polygon.polygon0x06.uv, 3, uvTransforms.at( polygon.polygon0x06.texture ), vertextexcoords );
+						break;
+					case TEXTURED_QUAD_VERTEX_COLOR:
+						transformUVs( polygon.polygon0x08.uv, 4, uvTransforms.at( polygon.polygon0x08.texture ), vertextexcoords );
+						break;
+					default:
+						break;
+				}
+			}
+
+			vertexcoordindex += (int)( vertextexcoords.size() - firsttexcoord );
+		}
+
+#if DEBUG_OUTPUT
+		printLine( "Reading vertexcolors..." );
+#endif
+
+		// read vertex colors from polygons
+		for ( size_t p = 0; p < objects[o].polygons.size(); p++ )
+		{
+			if ( objects[o].polygons[p].type == FLAT_TRIS_FACE_COLOR )
+			{
+				Color vertexcolor = int32ToColor( objects[o].polygons[p].polygon0x01.color );
+				vertexcolors.push_back(vertexcolor);
+				vertexcolorindex++;
+			}
+			if ( objects[o].polygons[p].type == TEXTURED_TRIS_FACE_COLOR )
+			{
+				Color vertexcolor = int32ToColor( objects[o].polygons[p].polygon0x02.color );
+				vertexcolors.push_back(vertexcolor);
+				vertexcolorindex++;
+			}
+			if ( objects[o].polygons[p].type == FLAT_QUAD_FACE_COLOR )
+			{
+				Color vertexcolor = int32ToColor( objects[o].polygons[p].polygon0x03.color );
+				vertexcolors.push_back(vertexcolor);
+				vertexcolorindex++;
+			}
+			if ( objects[o].polygons[p].type == TEXTURED_QUAD_FACE_COLOR )
+			{
+				Color vertexcolor = int32ToColor( objects[o].polygons[p].polygon0x04.color );
+				vertexcolors.push_back(vertexcolor);
+				vertexcolorindex++;
+			}
+			if ( objects[o].polygons[p].type == FLAT_TRIS_VERTEX_COLOR )
+			{
+				for ( int j = 0; j < 3; j++ )
+				{
+					Color vertexcolor = int32ToColor( objects[o].polygons[p].polygon0x05.colors[j] );
+					vertexcolors.push_back(vertexcolor);
+					vertexcolorindex++;
+				}
+			}
+			if ( objects[o].polygons[p].type == TEXTURED_TRIS_VERTEX_COLOR )
+			{
+				for ( int j = 0; j < 3; j++ )
+				{
+					Color vertexcolor = int32ToColor( objects[o].polygons[p].polygon0x06.colors[j] );
+					vertexcolors.push_back(vertexcolor);
+					vertexcolorindex++;
+				}
+			}
+			if ( objects[o].polygons[p].type == FLAT_QUAD_VERTEX_COLOR )
+			{
+				for ( int j = 0; j < 4; j++ )
+				{
+					Color vertexcolor = int32ToColor( objects[o].polygons[p].polygon0x07.colors[j] );
+					vertexcolors.push_back(vertexcolor);
+					vertexcolorindex++;
+				}
+			}
+			if ( objects[o].polygons[p].type == TEXTURED_QUAD_VERTEX_COLOR )
+			{
+				for ( int j = 0; j < 4; j++ )
+				{
+					Color vertexcolor = int32ToColor( objects[o].polygons[p].polygon0x08.colors[j] );
+					vertexcolors.push_back(vertexcolor);
+					vertexcolorindex++;
+				}
+			}
+		}
+
+#if DEBUG_OBJ
+		obj << "# VERTEXuvINDEX_START " << currentvertexcoordindex << "\n";
+		obj << "# VERTEXuvINDEX_END " << currentvertexcoordindex + vertextexcoords.size() << "\n";
+#endif
+
+#if DEBUG_OUTPUT
+		printLine( "Writing texcoords..." );
+#endif
+
+		// write out the vertex texcoords
+		for ( size_t i = 0; i < vertextexcoords.size(); i++ )
+		{
+
+			obj << "vt " 
+				<< vertextexcoords[i].u 
+				<< " " 
+				<< vertextexcoords[i].v 
+				<< "\n";
+		}
+
+#if DEBUG_OUTPUT
+		printLine( "Writing vertex colors..." );
+#endif
+
+#if DEBUG_OBJ
+			obj << "# VERTEXCOLORINDEX_START " << currentvertexcolorindex << "\n";
+			obj << "# VERTEXCOLORINDEX_END " << currentvertexcolorindex + vertexcolors.size() << "\n";
+#endif
 
 		// write out the vertex colors
 		for ( size_t i = 0; i < vertexcolors.size(); i++ )
 		{
-			obj 
-				<< "#vcolor" 
-				<< " " << std::to_string(vertexcolors[i].r) 
-				<< " " << std::to_string(vertexcolors[i].g) 
-				<< " " << std::to_string(vertexcolors[i].b) 
-				<< "\n";
+			obj 
+				<< "#vcolor" 
+				<< " " << vertexcolors[i].r 
+				<< " " << vertexcolors[i].g 
+				<< " " << vertexcolors[i].b 
+				<< "\n";
+		}
+
+		int coloroffset = 1;
+		int texcoordoffset = 1;
+
+#if DEBUG_OUTPUT
+		printLine( "Writing polygons..." );
+#endif
+
+		obj << "s off" << "\n";
+
+		// every polygon keeps the texcoord and color offsets it has in file order, so they can be written in any order
+		std::vector<size_t> polygonOrder( objects[o].polygons.size() );
+		std::vector<ObjIndexBase> polygonOffsets( objects[o].polygons.size() );
+		ObjIndexBase polygonOffset;
+		for ( size_t p = 0; p < objects[o].polygons.size(); p++ )
+		{
+			polygonOrder[p] = p;
+			polygonOffsets[p] = polygonOffset;
+			ObjIndexBase counts = countObjPolygon( objects[o].polygons[p], true );
+			polygonOffset.texcoord += counts.texcoord;
+			polygonOffset.color += counts.color;
+		}
+
+#if SORTED_MATERIALS_OBJ
+		std::stable_sort( polygonOrder.begin(), polygonOrder.end(), [&]( size_t a, size_t b )
+		{
+			return objPolygonMaterial( objects[o].polygons[a] ) < objPolygonMaterial( objects[o].polygons[b] );
+		} );
+#endif
+
+		int currentMaterial = -2;
+		auto useMaterial = [&]( int texture )
+		{
+#if SORTED_MATERIALS_OBJ
+			if ( texture == currentMaterial )
+				return;
+#endif
+			currentMaterial = texture;
+			if ( texture < 0 )
+				obj << "usemtl dummy" << "\n";
+			else
+				obj << "usemtl " << filename << texture << "\n";
+		};
+		
+		// write polygons... sigh
+		for ( size_t n = 0; n < polygonOrder.size(); n++ )
+		{
+			size_t p = polygonOrder[n];
+			coloroffset = polygonOffsets[p].color + 1;
+			texcoordoffset = polygonOffsets[p].texcoord + 1;
+
+#if SPRITES_OBJ
+			if ( objects[o].polygons[p].type == SPRITE_TOP_ANCHOR )
+			{
+
+				Vertex32 vertex = objects[o].vertices[objects[o].polygons[p].polygon0x0A.index];
+				Color vertexcolor = int32ToColor( objects[o].polygons[p].polygon0x0A.color );
+				uint16_t tex = objects[o].polygons[p].polygon0x0A.texture;
+				uint16_t width = objects[o].polygons[p].polygon0x0A.width;
+				uint16_t height = objects[o].polygons[p].polygon0x0A.height;
+
+				spr << "o sprite_" << sprindex << "\n";
+				spr << "v " << vertex.x << " " << vertex.y << " " << vertex.z << "\n";
+				spr << "# color:" << vertexcolor.r << " " << vertexcolor.g << " " << vertexcolor.b << "\n";
+				spr << "# texture:" << tex << "\n";
+				spr << "# width:" << width << "\n";
+				spr << "# height:" << height << "\n";
+				sprindex++;
+			}
+			if ( objects[o].polygons[p].type == SPRITE_BOTTOM_ANCHOR )
+			{
+
+				Vertex32 vertex = objects[o].vertices[objects[o].polygons[p].polygon0x0B.index];
+				Color vertexcolor = int32ToColor( objects[o].polygons[p].polygon0x0B.color );
+				uint16_t tex = objects[o].polygons[p].polygon0x0B.texture;
+				uint16_t width = objects[o].polygons[p].polygon0x0B.width;
+				uint16_t height = objects[o].polygons[p].polygon0x0B.height;
+						
+				spr << "o sprite_" << sprindex << "\n";
+				spr << "v " << vertex.x << " " << vertex.y << " " << vertex.z << "\n";
+				spr << "# color:" << vertexcolor.r << " " << vertexcolor.g << " " << vertexcolor.b << "\n";
+				spr << "# texture:" << filename << tex << "\n";
+				spr << "# width:" << width << "\n";
+				spr << "# height:" << height << "\n";
+				sprindex++;
+			}
+#endif
+			if ( objects[o].polygons[p].type == FLAT_TRIS_FACE_COLOR )
+			{
+				bool degenerate = false;
+
+				for ( int i = 0; i < 3; i++ )
+				{
+					for ( int j = 0; j < 3; j++ )
+					{
+						if ( j != i && objects[o].polygons[p].polygon0x01.indices[i] == objects[o].polygons[p].polygon0x01.indices[j] )
+						{
+#if DEGENERATES_OBJ
+							degenerate = true;
+#else
+							degenerate = false;
+#endif
+						}
+					}
+				}
+
+				if ( !degenerate )
+				{
+#if MTL_OBJ
+					useMaterial( -1 );
+#endif
+
+					obj << "f " 
+						<< objects[o].polygons[p].polygon0x01.indices[TRIS_VERTEX0] + 1 + currentvertexindex
+						<< "/" 
+						<< "/"  
+						<< " " ;
+					obj << objects[o].polygons[p].polygon0x01.indices[TRIS_VERTEX1] + 1 + currentvertexindex
+						<< "/" 
+						<< "/"  
+						<< " " ;
+					obj << objects[o].polygons[p].polygon0x01.indices[TRIS_VERTEX2] + 1 + currentvertexindex
+						<< "/" 
+						<< "/"  
+						<< " " ;
+					obj << "\n";
+
+					obj << "#fvcolorindex " << 
+						coloroffset + currentvertexcolorindex
+						<< " " << 
+						coloroffset + currentvertexcolorindex
+						<< " " << 
+						coloroffset + currentvertexcolorindex
+						<< "\n";
+
+					coloroffset++;
+				}
+			}
+			if ( objects[o].polygons[p].type == TEXTURED_TRIS_FACE_COLOR )
+			{
+				bool degenerate = false;
+
+				for ( int i = 0; i < 3; i++ )
+				{
+					for ( int j = 0; j < 3; j++ )
+					{
+						if ( j != i && objects[o].polygons[p].polygon0x02.indices[i] == objects[o].polygons[p].polygon0x02.indices[j] )
+						{
+#if DEGENERATES_OBJ
+							degenerate = true;
+#else
+							degenerate = false;
+#endif
+						}
+					}
+				}
+
+				if ( !degenerate )
+				{
+#if MTL_OBJ
+					useMaterial( objects[o].polygons[p].polygon0x02.texture );
+#endif
+
+					obj << "f " 
+						<< objects[o].polygons[p].polygon0x02.indices[TRIS_VERTEX0] + 1 + currentvertexindex
+						<< "/" 
+						<< texcoordoffset + TRIS_VERTEX0 + currentvertexcoordindex
+						<< "/" 
+						<< texcoordoffset + TRIS_VERTEX0 + currentvertexcoordindex
+						<< " " ;
+					obj << objects[o].polygons[p].polygon0x02.indices[TRIS_VERTEX1] + 1 + currentvertexindex
+						<< "/" 
+						<< texcoordoffset + TRIS_VERTEX1 + currentvertexcoordindex
+						<< "/" 
+						<< texcoordoffset + TRIS_VERTEX1 + currentvertexcoordindex 
+						<< " " ;
+					obj << objects[o].polygons[p].polygon0x02.indices[TRIS_VERTEX2] + 1 + currentvertexindex
+						<< "/" 
+						<< texcoordoffset + TRIS_VERTEX2 + currentvertexcoordindex
+						<< "/" 
+						<< texcoordoffset + TRIS_VERTEX2 + currentvertexcoordindex 
+						<< " " ;
+					obj << "\n";
+
+					obj << "#fvcolorindex " << 
+						coloroffset + currentvertexcolorindex
+						<< " " << 
+						coloroffset + currentvertexcolorindex
+						<< " " << 
+						coloroffset + currentvertexcolorindex
+						<< "\n";
+
+					coloroffset++;
+					texcoordoffset += 3;
+				}
+			}
+			if ( objects[o].polygons[p].type == FLAT_QUAD_FACE_COLOR )
+			{
+				bool degenerate = false;
+
+				for ( int i = 0; i < 4; i++ )
+				{
+					for ( int j = 0; j < 4; j++ )
+					{
+						if ( j != i && objects[o].polygons[p].polygon0x04.indices[i] == objects[o].polygons[p].polygon0x04.indices[j] )
+						{
+#if DEGENERATES_OBJ
+							degenerate = true;
+#else
+							degenerate = false;
+#endif
+						}
+					}
+				}
+
+				if ( !degenerate )
+				{
+#if MTL_OBJ
+					useMaterial( -1 );
+#endif
+
+					obj << "f " 
+						<< objects[o].polygons[p].polygon0x03.indices[QUAD_VERTEX0] + 1 + currentvertexindex
+						<< "/" 
+						<< "/"  
+						<< " " ;
+					obj << objects[o].polygons[p].polygon0x03.indices[QUAD_VERTEX1] + 1 + currentvertexindex
+						<< "/" 
+						<< "/"  
+						<< " " ;
+					obj << objects[o].polygons[p].polygon0x03.indices[QUAD_VERTEX2] + 1 + currentvertexindex
+						<< "/" 
+						<< "/"  
+						<< " " ;
+					obj << objects[o].polygons[p].polygon0x03.indices[QUAD_VERTEX3] + 1 + currentvertexindex
+						<< "/" 
+						<< "/"  
+						<< " " ;
+					obj << "\n";
+
+					obj << "#fvcolorindex " << 
+						coloroffset + currentvertexcolorindex
+						<< " " << 
+						coloroffset + currentvertexcolorindex
+						<< " " << 
+						coloroffset + currentvertexcolorindex
+						<< " " << 
+						coloroffset + currentvertexcolorindex
+						<< "\n";
+
+					coloroffset++;
+				}
+			}
+			if ( objects[o].polygons[p].type == TEXTURED_QUAD_FACE_COLOR )
+			{
+				bool degenerate = false;
+
+				for ( int i = 0; i < 4; i++ )
+				{
+					for ( int j = 0; j < 4; j++ )
+					{
+						if ( j != i && objects[o].polygons[p].polygon0x04.indices[i] == objects[o].polygons[p].polygon0x04.indices[j] )
+						{
+#if DEGENERATES_OBJ
+							degenerate = true;
+#else
+							degenerate = false;
+#endif
+						}
+					}
+				}
+
+				if ( !degenerate )
+				{
+#if MTL_OBJ
+					useMaterial( objects[o].polygons[p].polygon0x04.texture );
+#endif
+
+					obj << "f " 
+						<< objects[o].polygons[p].polygon0x04.indices[QUAD_VERTEX0] + 1 + currentvertexindex
+						<< "/" 
+						<< texcoordoffset + QUAD_VERTEX0 + currentvertexcoordindex
+						<< "/" 
+						<< texcoordoffset + QUAD_VERTEX0 + currentvertexcoordindex
+						<< " " ;
+					obj << objects[o].polygons[p].polygon0x04.indices[QUAD_VERTEX1] + 1 + currentvertexindex
+						<< "/" 
+						<< texcoordoffset + QUAD_VERTEX1 + currentvertexcoordindex
+						<< "/" 
+						<< texcoordoffset + QUAD_VERTEX1 + currentvertexcoordindex
+						<< " " ;
+					obj << objects[o].polygons[p].polygon0x04.indices[QUAD_VERTEX2] + 1 + currentvertexindex
+						<< "/" 
+						<< texcoordoffset + QUAD_VERTEX2 + currentvertexcoordindex
+						<< "/" 
+						<< texcoordoffset + QUAD_VERTEX2 + currentvertexcoordindex
+						<< " " ;
+					obj << objects[o].polygons[p].polygon0x04.indices[QUAD_VERTEX3] + 1 + currentvertexindex
+						<< "/" 
+						<< texcoordoffset + QUAD_VERTEX3 + currentvertexcoordindex
+						<< "/" 
+						<< texcoordoffset + QUAD_VERTEX3 + currentvertexcoordindex
+						<< " " ;
+					obj << "\n";
+
+					obj << "#fvcolorindex " << 
+						coloroffset + currentvertexcolorindex
+						<< " " << 
+						coloroffset + currentvertexcolorindex
+						<< " " << 
+						coloroffset + currentvertexcolorindex
+						<< " " << 
+						coloroffset + currentvertexcolorindex
+						<< "\n";
+
+					coloroffset++;
+					texcoordoffset += 4;
+				}
+			}
+			if ( objects[o].polygons[p].type == FLAT_TRIS_VERTEX_COLOR )
+			{
+				bool degenerate = false;
+
+				for ( int i = 0; i < 3; i++ )
+				{
+					for ( int j = 0; j < 3; j++ )
+					{
+						if ( j != i && objects[o].polygons[p].polygon0x05.indices[i] == objects[o].polygons[p].polygon0x05.indices[j] )
+						{
+#if DEGENERATES_OBJ
+							degenerate = true;
+#else
+							degenerate = false;
+#endif
+						}
+					}
+				}
+
+				if ( !degenerate )
+				{
+#if MTL_OBJ
+					useMaterial( -1 );
+#endif
+
+					obj << "f " 
+						<< objects[o].polygons[p].polygon0x05.indices[TRIS_VERTEX0] + 1 + currentvertexindex
+						<< "/" 
+						<< "/"  
+						<< " " ;
+					obj << objects[o].polygons[p].polygon0x05.indices[TRIS_VERTEX1] + 1 + currentvertexindex
+						<< "/" 
+						<< "/"  
+						<< " " ;
+					obj << objects[o].polygons[p].polygon0x05.indices[TRIS_VERTEX2] + 1 + currentvertexindex
+						<< "/" 
+						<< "/"  
+						<< " " ;
+					obj << "\n";
+
+					obj << "#fvcolorindex " << 
+						coloroffset + TRIS_VERTEX0 + currentvertexcolorindex
+						<< " " << 
+						coloroffset + TRIS_VERTEX1 + currentvertexcolorindex
+						<< " " << 
+						coloroffset + TRIS_VERTEX2 + currentvertexcolorindex
+						<< "\n";
+
+					coloroffset += 3;
+				}
+			}
+			if ( objects[o].polygons[p].type == TEXTURED_TRIS_VERTEX_COLOR )
+			{
+				bool degenerate = false;
+
+				for ( int i = 0; i < 3; i++ )
+				{
+					for ( int j = 0; j < 3; j++ )
+					{
+						if ( j != i && objects[o].polygons[p].polygon0x06.indices[i] == objects[o].polygons[p].polygon0x06.indices[j] )
+						{
+#if DEGENERATES_OBJ
+							degenerate = true;
+#else
+							degenerate = false;
+#endif
+						}
+					}
+				}
+
+				if ( !degenerate )
+				{
+#if MTL_OBJ
+					useMaterial( objects[o].polygons[p].polygon0x06.texture );
+#endif
+					obj << "f " 
+						<< objects[o].polygons[p].polygon0x06.indices[TRIS_VERTEX0] + 1 + currentvertexindex
+						<< "/" 
+						<< texcoordoffset + TRIS_VERTEX0 + currentvertexcoordindex
+						<< "/" 
+						<< texcoordoffset + TRIS_VERTEX0 + currentvertexcoordindex
+						<< " " ;
+					obj << objects[o].polygons[p].polygon0x06.indices[TRIS_VERTEX1] + 1 + currentvertexindex
+						<< "/" 
+						<< texcoordoffset + TRIS_VERTEX1 + currentvertexcoordindex
+						<< "/" 
+						<< texcoordoffset + TRIS_VERTEX1 + currentvertexcoordindex
+						<< " " ;
+					obj << objects[o].polygons[p].polygon0x06.indices[TRIS_VERTEX2] + 1 + currentvertexindex
+						<< "/" 
+						<< texcoordoffset + TRIS_VERTEX2 + currentvertexcoordindex
+						<< "/" 
+						<< texcoordoffset + TRIS_VERTEX2 + currentvertexcoordindex
+						<< " " ;
+					obj << "\n";
+
+					obj << "#fvcolorindex " << 
+						coloroffset + TRIS_VERTEX0 + currentvertexcolorindex
+						<< " " << 
+						coloroffset + TRIS_VERTEX1 + currentvertexcolorindex
+						<< " " << 
+						coloroffset + TRIS_VERTEX2 + currentvertexcolorindex
+						<< "\n";
+
+					coloroffset += 3;
+					texcoordoffset += 3;
+				}
+			}
+			if ( objects[o].polygons[p].type == FLAT_QUAD_VERTEX_COLOR )
+			{
+				bool degenerate = false;
+
+				for ( int i = 0; i < 4; i++ )
+				{
+					for ( int j = 0; j < 4; j++ )
+					{
+						if ( j != i && objects[o].polygons[p].polygon0x07.indices[i] == objects[o].polygons[p].polygon0x07.indices[j] )
+						{
+#if DEGENERATES_OBJ
+							degenerate = true;
+#else
+							degenerate = false;
+#endif
+						}
+					}
+				}
+
+				if ( !degenerate )
+				{
+#if MTL_OBJ
+					useMaterial( -1 );
+#endif
+
+					obj << "f " 
+						<< objects[o].polygons[p].polygon0x07.indices[QUAD_VERTEX0] + 1 + currentvertexindex
+						<< "/" 
+						<< "/"  
+						<< " " ;
+					obj << objects[o].polygons[p].polygon0x07.indices[QUAD_VERTEX1] + 1 + currentvertexindex
+						<< "/" 
+						<< "/"  
+						<< " " ;
+					obj << objects[o].polygons[p].polygon0x07.indices[QUAD_VERTEX2] + 1 + currentvertexindex
+						<< "/" 
+						<< "/"  
+						<< " " ;
+					obj << objects[o].polygons[p].polygon0x07.indices[QUAD_VERTEX3] + 1 + currentvertexindex
+						<< "/" 
+						<< "/"  
+						<< " " ;
+					obj << "\n";
+
+					obj << "#fvcolorindex " << 
+						coloroffset + QUAD_VERTEX0 + currentvertexcolorindex
+						<< " " << 
+						coloroffset + QUAD_VERTEX1 + currentvertexcolorindex
+						<< " " << 
+						coloroffset + QUAD_VERTEX2 + currentvertexcolorindex
+						<< " " << 
+						coloroffset + QUAD_VERTEX3 + currentvertexcolorindex
+						<< "\n";
+
+					coloroffset += 4;
+				}
+			}
+			if ( objects[o].polygons[p].type == TEXTURED_QUAD_VERTEX_COLOR )
+			{
+				bool degenerate = false;
+
+				for ( int i = 0; i < 4; i++ )
+				{
+					for ( int j = 0; j < 4; j++ )
+					{
+						if ( j != i && objects[o].polygons[p].polygon0x08.indices[i] == objects[o].polygons[p].polygon0x08.indices[j] )
+						{
+#if DEGENERATES_OBJ
+							degenerate = true;
+#else
+							degenerate = false;
+#endif
+						}
+					}
+				}
+
+				if ( !degenerate )
+				{
+#if MTL_OBJ
+					useMaterial( objects[o].polygons[p].polygon0x08.texture );
+#endif
+					obj << "f " 
+						<< objects[o].polygons[p].polygon0x08.indices[QUAD_VERTEX0] + 1 + currentvertexindex
+						<< "/" 
+						<< texcoordoffset + QUAD_VERTEX0 + currentvertexcoordindex
+						<< "/" 
+						<< texcoordoffset + QUAD_VERTEX0 + currentvertexcoordindex
+						<< " " ;
+					obj << objects[o].polygons[p].polygon0x08.indices[QUAD_VERTEX1] + 1 + currentvertexindex
+						<< "/" 
+						<< texcoordoffset + QUAD_VERTEX1 + currentvertexcoordindex
+						<< "/" 
+						<< texcoordoffset + QUAD_VERTEX1 + currentvertexcoordindex
+						<< " " ;
+					obj << objects[o].polygons[p].polygon0x08.indices[QUAD_VERTEX2] + 1 + currentvertexindex
+						<< "/" 
+						<< texcoordoffset + QUAD_VERTEX2 + currentvertexcoordindex
+						<< "/" 
+						<< texcoordoffset + QUAD_VERTEX2 + currentvertexcoordindex
+						<< " " ;
+					obj << objects[o].polygons[p].polygon0x08.indices[QUAD_VERTEX3] + 1 + currentvertexindex
+						<< "/" 
+						<< texcoordoffset + QUAD_VERTEX3 + currentvertexcoordindex
+						<< "/" 
+						<< texcoordoffset + QUAD_VERTEX3 + currentvertexcoordindex
+						<< " " ;
+					obj << "\n";
+
+					obj << "#fvcolorindex " << 
+						coloroffset + QUAD_VERTEX0 + currentvertexcolorindex
+						<< " " << 
+						coloroffset + QUAD_VERTEX1 + currentvertexcolorindex
+						<< " " << 
+						coloroffset + QUAD_VERTEX2 + currentvertexcolorindex
+						<< " " << 
+						coloroffset + QUAD_VERTEX3 + currentvertexcolorindex
+						<< "\n";
+
+					coloroffset += 4;
+					texcoordoffset += 4;
+				}
+			}
+		}
+
+#if !MERGED_OBJ
+			writeObjectsMTL( mtlname, filename, images.size() );
+
+			obj.close();
+#endif
+
+#if DEBUG_OUTPUT
+		printLine( "Object vertex count: ", std::to_string( objects[o].vertices.size()) );
+
+		printText( "OBJ file written successfully!" );
+#endif
+	};
+
+#if MERGED_OBJ
+	parallelFor( objects.size(), [&]( size_t o )
+	{
+		buffers[o].reset( new ObjWriter( 256 * 1024 ) );
+		writeObject( o, *buffers[o] );
+	} );
+
+	// concatenated in order, so the file is the same whatever the thread count
+	for ( size_t o = 0; o < objects.size(); o++ )
+	{
+		obj.write( buffers[o]->buffer.data(), buffers[o]->used );
+		buffers[o].reset();
+#if SPRITES_OBJ
+		spr.write( sprbuffers[o]->buffer.data(), sprbuffers[o]->used );
+		sprbuffers[o].reset();
+#endif
+#if !POSITION_OBJ
+		// write .txt of what position each object is at. I use this for the port to source engine
+		txt << objects[o].header.position.x << " " << objects[o].header.position.y << " " << objects[o].header.position.z << "\n";
+#endif
+	}
+#else
+	for ( size_t o = 0; o < objects.size(); o++ )
+	{
+		writeObject( o, obj );
+	}
+#endif
+
+#if MERGED_OBJ
+	writeObjectsMTL( mtlname, filename, images.size() );
+
+	obj.close();
+#endif
+}
+
+//
+// track
+//
+
+
+// tiles[r * columns + c] at row r, column c, missing tiles stay transparent
+Image composeAtlas( const std::vector<Image> &images, const int16_t *tiles, int columns, int rows )
+{
+	int tileWidth = 32, tileHeight = 32;
+	for ( int i = 0; i < columns * rows; i++ )
+	{
+		if ( tiles[i] >= 0 && tiles[i] < (int)images.size() )
+		{
+			tileWidth = images[tiles[i]].width;
+			tileHeight = images[tiles[i]].height;
+			break;
+		}
+	}
+
+	Image atlas;
+	atlas.width = tileWidth * columns;
+	atlas.height = tileHeight * rows;
+	atlas.pixels.assign( atlas.width * atlas.height * 4, 0 );
+
+	for ( int i = 0; i < columns * rows; i++ )
+	{
+		if ( tiles[i] < 0 || tiles[i] >= (int)images.size() )
+			continue;
+
+		const Image &tile = images[tiles[i]];
+		int width = std::min( tile.width, tileWidth ), height = std::min( tile.height, tileHeight );
+		for ( int y = 0; y < height; y++ )
+		{
+			memcpy( &atlas.pixels[( ( ( i / columns ) * tileHeight + y ) * atlas.width + ( i % columns ) * tileWidth ) * 4],
+				&tile.pixels[y * tile.width * 4], width * 4 );
+		}
+	}
+
+	return atlas;
+}
+
+// the faces of a section are a range but their vertices aren't, so they go through an index list
+std::vector<Bounds> trackSectionBounds( const Track &theTrack )
+{
+	std::vector<Bounds> bounds( theTrack.sections.size() );
+
+	parallelFor( theTrack.sections.size(), [&]( size_t s )
+	{
+		const TrackSection &section = theTrack.sections[s];
+		size_t last = std::min( (size_t)section.firstFace + section.numFaces, theTrack.faces.size() );
+
+		std::vector<uint32_t> indices;
+		for ( size_t i = section.firstFace; i < last; i++ )
+		{
+			for ( int k = 0; k < 4; k++ )
+			{
+				int index = theTrack.faces[i].indices[k];
+				if ( index >= 0 && index < (int)theTrack.vertices.size() )
+					indices.push_back( (uint32_t)index );
+			}
+		}
+
+		bounds[s] = bounds_indexed( (const int32_t*)theTrack.vertices.data(), 4, indices.data(), indices.size() );
+	} );
+
+	return bounds;
+}
+
+Track loadTrack( std::vector<Image> &images )
+{
+	Track theTrack;
+
+	// every file is read straight into its final array and converted in place
+	if ( !readArray( "LIBRARY.TTF", theTrack.textureIndex ) )
+	{
+		printText( "Error! LIBRARY.TFF is missing or corrupt!" ); 
+		system("pause");
+		std::exit(0);
+	}
+	endianConvertArray( theTrack.textureIndex.data(), theTrack.textureIndex.data(), theTrack.textureIndex.size() );
+
+	// 4x4 32px tiles
+	theTrack.images.resize( theTrack.textureIndex.size() );
+
+	for ( unsigned int i = 0; i < theTrack.textureIndex.size(); i++ )
+	{
+		const TrackTextureIndex &idx = theTrack.textureIndex[i];
+		Image &canvas = theTrack.images[i];
+		canvas.width = 128;
+		canvas.height = 128; 
+		canvas.pixels.reserve( 128 * 128 * 4 );
+
+		for ( int x = 0; x < 4; x++ ) 
+		{
+			for ( int y = 0; y < 4; y++ ) 
+			{		
+				const std::vector<uint8_t> &ctx = images[idx.nearest[y * 4 + x]].pixels;
+				canvas.pixels.insert( canvas.pixels.end(), ctx.begin(), ctx.end() );
+			}
+		}
+
+		// the lower detail versions for the lods
+		theTrack.mediumImages.push_back( composeAtlas( images, idx.mediumest, 2, 2 ) );
+		theTrack.farImages.push_back( composeAtlas( images, &idx.farthest, 1, 1 ) );
+	}
+
+	if ( !readArray( "TRACK.TRV", theTrack.vertices ) )
+	{
+		printText( "Error! TRACK.TRV is missing or corrupt!" );
+		system("pause");
+		std::exit(0);
+	}
+	endianConvertArray( theTrack.vertices.data(), theTrack.vertices.data(), theTrack.vertices.size() );
+
+#if 0
+	for ( size_t i = 0; i < theTrack.vertices.size(); i++ )
+	{
+		theTrack.vertices[i].y *= -1;
+		theTrack.vertices[i].z *= -1;
+	}
+#endif
+
+	if ( !readArray( "TRACK.TRF", theTrack.faces ) )
+	{
+		printText( "Error! TRACK.TRF is missing or corrupt!" );
+		system("pause");
+		std::exit(0);
+	}
+	endianConvertArray( theTrack.faces.data(), theTrack.faces.data(), theTrack.faces.size() );
+
+	if ( bSequel )
+	{
+		// bytes only, nothing to convert
+		if ( !readArray( "TRACK.TEX", theTrack.textures ) )
+		{
+			printText( "Error! TRACK.TEX is missing or corrupt!" );
+			system("pause");
+			std::exit(0);
+		}	
+
+		size_t count = std::min( theTrack.faces.size(), theTrack.textures.size() );
+		for ( size_t i = 0; i < count; i++ )
+		{
+			theTrack.faces[i].tile = theTrack.textures[i].tile;
+			theTrack.faces[i].flags = theTrack.textures[i].flags;
+		}
+	}
+
+	// a track without sections still exports
+	if ( readArray( "TRACK.TRS", theTrack.sections ) )
+		endianConvertArray( theTrack.sections.data(), theTrack.sections.data(), theTrack.sections.size() );
+
+	// the morton sort only moves faces within their section, so these stay valid
+	theTrack.sectionBounds = trackSectionBounds( theTrack );
+
+	return theTrack;
+}
+
+// spreads the low 21 bits out to every third bit
+uint64_t mortonSpread( uint64_t v )
+{
+	v &= 0x1fffff;
+	v = ( v | ( v << 32 ) ) & 0x001f00000000ffffull;
+	v = ( v | ( v << 16 ) ) & 0x001f0000ff0000ffull;
+	v = ( v | ( v << 8 ) ) & 0x100f00f00f00f00full;
+	v = ( v | ( v << 4 ) ) & 0x10c30c30c30c30c3ull;
+	v = ( v | ( v << 2 ) ) & 0x1249249249249249ull;
+	return v;
+}
+
+// z-order key of a point, the coordinates are scaled from the track bounds to 21 bits each
+struct MortonGrid
+{
+	int64_t lo[3];
+	double	scale[3];
+
+	MortonGrid( const std::vector<TrackVertex> &vertices )
+	{
+		int64_t hi[3];
+		for ( int k = 0; k < 3; k++ )
+		{
+			lo[k] = vertices.empty() ? 0 : INT64_MAX;
+			hi[k] = vertices.empty() ? 0 : INT64_MIN;
+		}
+		for ( size_t i = 0; i < vertices.size(); i++ )
+		{
+			const int32_t p[3] = { vertices[i].x, vertices[i].y, vertices[i].z };
+			for ( int k = 0; k < 3; k++ )
+			{
+				lo[k] = std::min( lo[k], (int64_t)p[k] );
+				hi[k] = std::max( hi[k], (int64_t)p[k] );
+			}
+		}
+		for ( int k = 0; k < 3; k++ )
+			scale[k] = hi[k] > lo[k] ? 0x1fffff / (double)( hi[k] - lo[k] ) : 0.0;
+	}
+
+	uint64_t key( int64_t x, int64_t y, int64_t z ) const
+	{
+		return mortonSpread( (uint64_t)( ( x - lo[0] ) * scale[0] ) )
+			| ( mortonSpread( (uint64_t)( ( y - lo[1] ) * scale[1] ) ) << 1 )
+			| ( mortonSpread( (uint64_t)( ( z - lo[2] ) * scale[2] ) ) << 2 );
+	}
+};
+
+// --morton, sorts the vertices and the faces of every section along a z-order curve
+// faces stay inside their section, so firstFace/numFaces don't change
+void mortonSortTrack( Track &theTrack )
+{
+	MortonGrid grid( theTrack.vertices );
+
+	// vertices
+	std::vector<std::pair<uint64_t, uint32_t>> order( theTrack.vertices.size() );
+	for ( size_t i = 0; i < theTrack.vertices.size(); i++ )
+	{
+		const TrackVertex &v = theTrack.vertices[i];
+		order[i] = std::make_pair( grid.key( v.x, v.y, v.z ), (uint32_t)i );
+	}
+	std::sort( order.begin(), order.end() );
+
+	std::vector<TrackVertex> vertices( order.size() );
+	std::vector<int16_t> remap( order.size() );
+	for ( size_t i = 0; i < order.size(); i++ )
+	{
+		vertices[i] = theTrack.vertices[order[i].second];
+		remap[order[i].second] = (int16_t)i;
+	}
+	theTrack.vertices.swap( vertices );
+
+	for ( size_t i = 0; i < theTrack.faces.size(); i++ )
+	{
+		for ( int k = 0; k < 4; k++ )
+		{
+			int16_t &index = theTrack.faces[i].indices[k];
+			if ( index >= 0 && (size_t)index < remap.size() )
+				index = remap[index];
+		}
+	}
+
+	// faces by the key of their center, within each section
+	std::vector<uint64_t> faceKeys( theTrack.faces.size() );
+	for ( size_t i = 0; i < theTrack.faces.size(); i++ )
+	{
+		int64_t center[3] = { 0, 0, 0 };
+		for ( int k = 0; k < 4; k++ )
+		{
+			int16_t index = theTrack.faces[i].indices[k];
+			if ( index < 0 || (size_t)index >= theTrack.vertices.size() )
+				continue;
+			center[0] += theTrack.vertices[index].x;
+			center[1] += theTrack.vertices[index].y;
+			center[2] += theTrack.vertices[index].z;
+		}
+		faceKeys[i] = grid.key( center[0] / 4, center[1] / 4, center[2] / 4 );
+	}
+
+	for ( size_t s = 0; s < theTrack.sections.size(); s++ )
+	{
+		size_t first = theTrack.sections[s].firstFace;
+		size_t last = std::min( first + theTrack.sections[s].numFaces, theTrack.faces.size() );
+		if ( first >= last )
+			continue;
+
+		std::vector<std::pair<uint64_t, uint32_t>> faceOrder;
+		for ( size_t i = first; i < last; i++ )
+			faceOrder.push_back( std::make_pair( faceKeys[i], (uint32_t)i ) );
+		std::sort( faceOrder.begin(), faceOrder.end() );
+
+		std::vector<TrackFace> faces;
+		for ( size_t i = 0; i < faceOrder.size(); i++ )
+			faces.push_back( theTrack.faces[faceOrder[i].second] );
+		std::copy( faces.begin(), faces.end(), theTrack.faces.begin() + first );
+	}
+}
+
+// the track as it always was exported, shared positions and 4 vt + 1 #vcolor per face
+void writeTrackOBJ( ObjWriter &obj, const Track &theTrack )
+{
+	std::vector<UV> vertextexcoords;
+	std::vector<Color> vertexcolors;
+
+	// write out the vertices
+	for ( size_t i = 0; i < theTrack.vertices.size(); i++ )
+	{
+		obj << "v " << theTrack.vertices[i].x << " " << theTrack.vertices[i].y << " " << theTrack.vertices[i].z << "\n";
+	}
+
+	// read texcoords and vertexcolors from faces
+	for ( size_t i = 0; i < theTrack.faces.size(); i++ )	
+	{
+		vertexcolors.push_back( trackFaceColor( theTrack.faces[i] ) );
+
+		int flipx = 0;
+
+		if ( theTrack.faces[i].flags & FLIP )
+			flipx = 1;
+
+		UV uv;
+		uv.u = 1 - flipx; uv.v = 0;
+		vertextexcoords.push_back( uv );
+		uv.u = 0 + flipx; uv.v = 0;
+		vertextexcoords.push_back( uv );
+		uv.u = 0 + flipx; uv.v = 1;
+		vertextexcoords.push_back( uv );
+		uv.u = 1 - flipx; uv.v = 1;
+		vertextexcoords.push_back( uv );
+	}
+
+	// write out the vertex texcoords
+	for ( size_t i = 0; i < vertextexcoords.size(); i++ )
+	{
+		obj << "vt " 
+			<< vertextexcoords[i].u 
+			<< " " 
+			<< vertextexcoords[i].v 
+			<< "\n";
+	}
+
+	// write out the vertex vcolors
+	for ( size_t i = 0; i < vertexcolors.size(); i++ )
+	{
+		obj 
+			<< "#vcolor" 
+			<< " " << vertexcolors[i].r 
+			<< " " << vertexcolors[i].g 
+			<< " " << vertexcolors[i].b 
+			<< "\n";
+	}
+
+	obj << "s off" << "\n";
+
+	// faces sorted by tile inside every section, faces outside the sections stay where they are
+	std::vector<size_t> faceOrder( theTrack.faces.size() );
+	for ( size_t i = 0; i < faceOrder.size(); i++ )
+		faceOrder[i] = i;
+#if SORTED_MATERIALS_OBJ
+	for ( size_t s = 0; s < theTrack.sections.size(); s++ )
+	{
+		size_t first = std::min( (size_t)theTrack.sections[s].firstFace, faceOrder.size() );
+		size_t last = std::min( first + theTrack.sections[s].numFaces, faceOrder.size() );
+		std::stable_sort( faceOrder.begin() + first, faceOrder.begin() + last, [&]( size_t a, size_t b )
+		{
+			return theTrack.faces[a].tile < theTrack.faces[b].tile;
+		} );
+	}
+#endif
+
+	int currentTile = -1;
+
+	// write out the faces
+	// NOTE: the indices are written in reverse order, the winding the track has always been exported with
+	for ( size_t n = 0; n < faceOrder.size(); n++ )
+	{
+		size_t i = faceOrder[n];
+		int j = (int)i * 4 + 1;
+
+#if SORTED_MATERIALS_OBJ
+		if ( theTrack.faces[i].tile != currentTile )
+#endif
+			obj << "usemtl track_" << theTrack.faces[i].tile << "\n";
+		currentTile = theTrack.faces[i].tile;
+
+		obj << "f " 
+			<< theTrack.faces[i].indices[3] + 1 
+			<< "/" 
+			<< j
+			<< "/" 
+			<< j 
+			<< " " ;
+		obj << theTrack.faces[i].indices[2] + 1 
+			<< "/" 
+			<< j + 1
+			<< "/" 
+			<< j + 1 
+			<< " " ;
+		obj << theTrack.faces[i].indices[1] + 1	
+			<< "/" 
+			<< j + 2
+			<< "/" 
+			<< j + 2 
+			<< " " ;
+		obj << theTrack.faces[i].indices[0] + 1 
+			<< "/" 
+			<< j + 3
+			<< "/" 
+			<< j + 3 
+			<< " " ;
+		obj << "\n";
+
+		obj << "#fvcolorindex " << 
+			i + 1
+			<< " " << 
+			i + 1
+			<< " " << 
+			i + 1
+			<< " " << 
+			i + 1
+			<< "\n";
+	}
+}
+
+void writeTrackMTL( const Track &theTrack, const char *filename )
+{
+	printText( "Writing MTL file ..." );
+
+	ObjWriter mtl(filename, 64 * 1024);
+
+	for ( size_t i = 0; i < theTrack.textureIndex.size(); i++ )
+	{
+		mtl << "newmtl track_" << i << "\n";
+		mtl << "map_Kd " << "track_" << i << ".tga" << "\n" << "\n";
+	}
+
+	mtl.close();
+
+	printText("MTL file written successfully!");
+}
+
+void writeTrack( const Track &theTrack, const std::vector<Mesh> &meshes )
+{
+	// NOTE: this uses the Goldeneye OBJ format, due to it supporting vertex colors, which normal OBJ does not.
+
+	printText( "Writing OBJ file to track.obj ..." );
+
+	ObjWriter obj("ripped_track/track.obj");
+
+	obj << "mtllib track.mtl"
+		<< "\n";
+
+	if ( options.bWeld )
+	{
+		// the welded track mesh
+		ObjStreams streams = splitObjStreams( meshes[0] );
+		printObjStreamStats( "track", streams.positions.size(), streams.uvs.size(), streams.colors.size() );
+		writeMeshOBJ( obj, meshes[0], streams, "track_", false, ObjIndexBase() );
+	}
+	else
+	{
+		writeTrackOBJ( obj, theTrack );
+	}
+
+	obj.close();
+
+	// path
+#if SECTIONS_OBJ
+	std::ofstream objs("ripped_track/sections.obj");
+
+	for ( size_t i = 0; i < theTrack.sections.size(); i++ )
+	{
+		objs << "v " << theTrack.sections[i].x << " " << theTrack.sections[i].y << " " << theTrack.sections[i].z << "\n";
+	}
+
+	objs.close();
+#endif
+
+	printLine( "Track vertex count: ", std::to_string(theTrack.vertices.size()) );
+
+	printText( "OBJ file written successfully!" );
+
+	writeTrackMTL( theTrack, "ripped_track/track.mtl" );
+}
+
+//
+// gltf
+//
+
+// the composed track images store the 32x32 tiles one after another, this lays them out as the 4x4
+// atlas the track uvs expect (the combined .bmp shows it rotated by 90 degrees)
+Image trackAtlas( const Image &composed )
+{
+	Image atlas;
+	atlas.width = composed.width;
+	atlas.height = composed.height;
+	atlas.pixels.resize( composed.pixels.size() );
+
+	for ( int y = 0; y < atlas.height; y++ )
+	{
+		for ( int x = 0; x < atlas.width; x++ )
+		{
+			int tile = ( x / 32 ) * 4 + ( y / 32 );
+			int pixel = ( y % 32 ) * 32 + ( x % 32 );
+			memcpy( &atlas.pixels[( y * atlas.width + x ) * 4], &composed.pixels[( tile * 1024 + pixel ) * 4], 4 );
+		}
+	}
+
+	return atlas;
+}
+
+void writeTrackGLB( const Track &theTrack, const std::vector<Mesh> &meshes, const char *filename )
+{
+	printText( "Writing GLB file ..." );
+
+	std::vector<Image> textures;
+	for ( size_t i = 0; i < theTrack.images.size(); i++ )
+		textures.push_back( trackAtlas( theTrack.images[i] ) );
+
+	// the single track mesh gets the bounds of all sections
+	std::vector<Bounds> bounds( 1, bounds_empty() );
+	for ( size_t s = 0; s < theTrack.sectionBounds.size(); s++ )
+		bounds[0] = bounds_merge( bounds[0], theTrack.sectionBounds[s] );
+
+	if ( !glb_write( filename, meshes, textures, &bounds ) )
+		printLine( "Error! could not write ", filename );
+	else
+		printText( "GLB file written successfully!" );
+}
+
+void writeObjectsGLB( const std::vector<Object> &objects, const std::vector<Mesh> &meshes, const std::vector<Image> &images, const char *filename )
+{
+	printText( "Writing GLB file ..." );
+
+	std::vector<Bounds> bounds( objects.size() );
+	for ( size_t o = 0; o < objects.size(); o++ )
+		bounds[o] = objects[o].bounds;
+
+	if ( !glb_write( filename, meshes, images, &bounds ) )
+		printLine( "Error! could not write ", filename );
+	else
+		printText( "GLB file written successfully!" );
+}
+
+//
+// ply
+//
+
+void writePLY( const std::vector<Mesh> &meshes, const char *filename )
+{
+	printText( "Writing PLY file ..." );
+
+	if ( !ply_write( filename, meshes ) )
+		printLine( "Error! could not write ", filename );
+	else
+		printText( "PLY file written successfully!" );
+}
+
+//
+// bounds
+//
+
+// the "min", "max", "center" and "radius" members, the box is whole numbers like the source data
+void writeBoundsJSON( ObjWriter &json, const Bounds &bounds )
+{
+	if ( bounds_isEmpty( bounds ) )
+	{
+		json << "\"min\": [0, 0, 0], \"max\": [0, 0, 0], \"center\": [0, 0, 0], \"radius\": -1";
+		return;
+	}
+
+	json << "\"min\": [" << lroundf( bounds.lo[0] ) << ", " << lroundf( bounds.lo[1] ) << ", " << lroundf( bounds.lo[2] ) << "]"
+		<< ", \"max\": [" << lroundf( bounds.hi[0] ) << ", " << lroundf( bounds.hi[1] ) << ", " << lroundf( bounds.hi[2] ) << "]"
+		<< ", \"center\": [" << bounds.center[0] << ", " << bounds.center[1] << ", " << bounds.center[2] << "]"
+		<< ", \"radius\": " << bounds.radius;
+}
+
+void writeTrackBounds( const Track &theTrack, const char *filename )
+{
+	Bounds all = bounds_empty();
+	for ( size_t s = 0; s < theTrack.sectionBounds.size(); s++ )
+		all = bounds_merge( all, theTrack.sectionBounds[s] );
+
+	ObjWriter json( filename, 64 * 1024 );
+	json << "{" << "\n";
+	json << "\t\"track\": { ";
+	writeBoundsJSON( json, all );
+	json << " }," << "\n";
+
+	json << "\t\"sections\": [" << "\n";
+	for ( size_t s = 0; s < theTrack.sectionBounds.size(); s++ )
+	{
+		json << "\t\t{ \"section\": " << s << ", ";
+		writeBoundsJSON( json, theTrack.sectionBounds[s] );
+		json << " }" << ( s + 1 < theTrack.sectionBounds.size() ? "," : "" ) << "\n";
+	}
+	json << "\t]" << "\n";
+	json << "}" << "\n";
+	json.close();
+
+	printLine( filename, ": ", theTrack.sectionBounds.size(), " sections" );
+}
+
+void writeObjectBounds( const std::vector<Object> &objects, const char *filename )
+{
+	ObjWriter json( filename, 64 * 1024 );
+	json << "{" << "\n";
+	json << "\t\"objects\": [" << "\n";
+	for ( size_t o = 0; o < objects.size(); o++ )
+	{
+		const Object &object = objects[o];
+		json << "\t\t{ \"name\": " << glb_string( objectName( object.header ) ) << ", \"index\": " << object.index
+			<< ", \"position\": [" << object.header.position.x << ", " << object.header.position.y << ", " << object.header.position.z << "], ";
+		writeBoundsJSON( json, object.bounds );
+		json << " }" << ( o + 1 < objects.size() ? "," : "" ) << "\n";
+	}
+	json << "\t]" << "\n";
+	json << "}" << "\n";
+	json.close();
+
+	printLine( filename, ": ", objects.size(), " objects" );
+}
+
+//
+// track chunks
+//
+
+int32_t chunkOfSection( int32_t section, size_t sectionCount, size_t sectionsPerChunk )
+{
+	if ( section < 0 || (size_t)section >= sectionCount )
+		return -1;
+	return (int32_t)( section / sectionsPerChunk );
+}
+
+// where a scenery object goes, the section nearest its centre and every section its box touches
+struct ObjectSections
+{
+	int32_t				 section;
+	std::vector<int32_t> sections;
+};
+
+std::vector<ObjectSections> binObjectsToSections( const Track &theTrack, const std::vector<Object> &objects )
+{
+	std::vector<Vectorf> positions( theTrack.sections.size() );
+	for ( size_t s = 0; s < theTrack.sections.size(); s++ )
+		positions[s] = { (float)theTrack.sections[s].x, (float)theTrack.sections[s].y, (float)theTrack.sections[s].z };
+
+	SectionGrid grid;
+	grid.build( positions );
+
+	// how far a section's box reaches from its position, to find the boxes through the positions
+	float reach = 0;
+	for ( size_t s = 0; s < theTrack.sectionBounds.size(); s++ )
+	{
+		const Bounds &bounds = theTrack.sectionBounds[s];
+		if ( bounds_isEmpty( bounds ) )
+			continue;
+		const float *p = &grid.positions[s].x;
+		for ( int k = 0; k < 3; k++ )
+			reach = std::max( reach, std::max( bounds.hi[k] - p[k], p[k] - bounds.lo[k] ) );
+	}
+
+	std::vector<ObjectSections> bins( objects.size() );
+	parallelFor( objects.size(), [&]( size_t o )
+	{
+		const Object &object = objects[o];
+		Bounds bounds = object.bounds;
+		if ( bounds_isEmpty( bounds ) )
+		{
+			const float position[3] = { (float)object.header.position.x, (float)object.header.position.y, (float)object.header.position.z };
+			for ( int k = 0; k < 3; k++ )
+				bounds.lo[k] = bounds.hi[k] = bounds.center[k] = position[k];
+			bounds.radius = 0;
+		}
+
+		bins[o].section = grid.nearest( bounds.center );
+
+		float lo[3], hi[3];
+		for ( int k = 0; k < 3; k++ )
+		{
+			lo[k] = bounds.lo[k] - reach;
+			hi[k] = bounds.hi[k] + reach;
+		}
+		std::vector<int32_t> candidates;
+		grid.gather( lo, hi, candidates );
+		std::sort( candidates.begin(), candidates.end() );
+
+		for ( size_t i = 0; i < candidates.size(); i++ )
+		{
+			const Bounds &section = theTrack.sectionBounds[candidates[i]];
+			bool bOverlaps = !bounds_isEmpty( section );
+			for ( int k = 0; k < 3 && bOverlaps; k++ )
+				bOverlaps = section.lo[k] <= bounds.hi[k] && section.hi[k] >= bounds.lo[k];
+			if ( bOverlaps )
+				bins[o].sections.push_back( candidates[i] );
 		}
+	} );
+
+	return bins;
+}
+
+// one .obj per chunk in local coordinates, and a manifest with where they go and how they connect
+// and which scenery objects stream in with them
+void writeTrackChunks( const Track &theTrack, const std::vector<Mesh> &chunks, const std::vector<Object> *scenery, const std::string &path )
+{
+	printText( "Writing track chunks ..." );
+
+	size_t sectionsPerChunk = std::max( options.chunkSections, (size_t)1 );
+	size_t sectionCount = theTrack.sections.size();
+
+	std::vector<std::string> filenames( chunks.size() );
+	parallelFor( chunks.size(), [&]( size_t c )
+	{
+		char name[32];
+		snprintf( name, sizeof(name), "track_chunk_%04d.obj", (int)c );
+		filenames[c] = name;
+
+		ObjWriter obj( path + name, 256 * 1024 );
+		obj << "mtllib track_chunks.mtl" << "\n";
+		writeMeshOBJ( obj, chunks[c], splitObjStreams( chunks[c] ), "track_", false, ObjIndexBase() );
+	} );
+
+	writeTrackMTL( theTrack, ( path + "track_chunks.mtl" ).c_str() );
+
+	std::vector<ObjectSections> bins;
+	if ( scenery )
+		bins = binObjectsToSections( theTrack, *scenery );
+
+	std::vector<std::vector<size_t>> chunkObjects( chunks.size() );
+	for ( size_t o = 0; o < bins.size(); o++ )
+	{
+		int32_t chunk = chunkOfSection( bins[o].section, sectionCount, sectionsPerChunk );
+		if ( chunk >= 0 && (size_t)chunk < chunks.size() )
+			chunkObjects[chunk].push_back( o );
+	}
+
+	ObjWriter json( path + "track_chunks.json", 256 * 1024 );
+	json << "{" << "\n";
+	json << "\t\"sectionsPerChunk\": " << sectionsPerChunk << "," << "\n";
+	json << "\t\"chunks\": [" << "\n";
+
+	for ( size_t c = 0; c < chunks.size(); c++ )
+	{
+		const Mesh &mesh = chunks[c];
+		size_t first = c * sectionsPerChunk;
+		size_t end = std::min( first + sectionsPerChunk, sectionCount );
+
+		// world space bounds
+		const float translation[3] = { mesh.translation.x, mesh.translation.y, mesh.translation.z };
+		Bounds bounds = bounds_empty();
+		for ( size_t s = first; s < end && s < theTrack.sectionBounds.size(); s++ )
+			bounds = bounds_merge( bounds, theTrack.sectionBounds[s] );
+
+		size_t triangles = 0;
+		for ( size_t p = 0; p < mesh.primitives.size(); p++ )
+			triangles += mesh.primitives[p].indices.size() / 3;
+
+		// the chunks the sections lead into, other than this one
+		int32_t next = chunkOfSection( theTrack.sections[end - 1].next, sectionCount, sectionsPerChunk );
+		int32_t previous = chunkOfSection( theTrack.sections[first].previous, sectionCount, sectionsPerChunk );
+		std::vector<int32_t> junctions;
+		for ( size_t s = first; s < end; s++ )
+		{
+			int32_t junction = chunkOfSection( theTrack.sections[s].nextJunction, sectionCount, sectionsPerChunk );
+			if ( junction >= 0 && junction != (int32_t)c && std::find( junctions.begin(), junctions.end(), junction ) == junctions.end() )
+				junctions.push_back( junction );
+		}
+
+		json << "\t\t{ \"file\": \"" << filenames[c] << "\""
+			<< ", \"origin\": [" << lroundf( translation[0] ) << ", " << lroundf( translation[1] ) << ", " << lroundf( translation[2] ) << "], ";
+		writeBoundsJSON( json, bounds );
+		json << ", \"firstSection\": " << first << ", \"sectionCount\": " << end - first
+			<< ", \"vertices\": " << mesh.vertices.size() << ", \"triangles\": " << triangles
+			<< ", \"next\": " << next << ", \"previous\": " << previous << ", \"nextJunction\": [";
+		for ( size_t j = 0; j < junctions.size(); j++ )
+			json << ( j ? ", " : "" ) << junctions[j];
+		json << "], \"objects\": [";
+		for ( size_t i = 0; i < chunkObjects[c].size(); i++ )
+			json << ( i ? ", " : "" ) << chunkObjects[c][i];
+		json << "] }" << ( c + 1 < chunks.size() ? "," : "" ) << "\n";
+	}
+
+	json << "\t]," << "\n";
+
+	// the raw links, -1 where there is none
+	json << "\t\"sections\": [" << "\n";
+	for ( size_t s = 0; s < sectionCount; s++ )
+	{
+		const TrackSection &section = theTrack.sections[s];
+		json << "\t\t{ \"chunk\": " << s / sectionsPerChunk
+			<< ", \"position\": [" << section.x << ", " << section.y << ", " << section.z << "]"
+			<< ", \"next\": " << section.next << ", \"previous\": " << section.previous << ", \"nextJunction\": " << section.nextJunction
+			<< ", \"flags\": " << section.flag << ", ";
+		writeBoundsJSON( json, s < theTrack.sectionBounds.size() ? theTrack.sectionBounds[s] : bounds_empty() );
+		json << " }" << ( s + 1 < sectionCount ? "," : "" ) << "\n";
+	}
+	json << "\t]," << "\n";
+
+	// the scenery in the order of its .PRM, the chunk objects above index this
+	size_t binned = 0;
+	json << "\t\"objects\": [" << "\n";
+	for ( size_t o = 0; o < bins.size(); o++ )
+	{
+		const Object &object = ( *scenery )[o];
+		json << "\t\t{ \"name\": " << glb_string( objectName( object.header ) ) << ", \"index\": " << object.index
+			<< ", \"section\": " << bins[o].section << ", \"chunk\": " << chunkOfSection( bins[o].section, sectionCount, sectionsPerChunk )
+			<< ", \"sections\": [";
+		for ( size_t i = 0; i < bins[o].sections.size(); i++ )
+			json << ( i ? ", " : "" ) << bins[o].sections[i];
+		json << "] }" << ( o + 1 < bins.size() ? "," : "" ) << "\n";
+		binned += bins[o].section >= 0;
+	}
+	json << "\t]" << "\n";
+	json << "}" << "\n";
+	json.close();
+
+	printLine( path, "track_chunks.json: ", chunks.size(), " chunks, ", binned, " of ", bins.size(), " objects binned" );
+}
+
+//
+// track lod
+//
 
-		int coloroffset = 1;
-		int texcoordoffset = 1;
+// lod n joins the faces of up to 2^n consecutive sections of the same lod chunk, lod 1 uses the mediumest
+// textures and lod 2 the farthest. A lod chunk is the smallest whole number of --chunk-sections chunks
+// holding at least 2^TRACK_LOD_LEVELS sections, so every level can join fully and still line up with
+// the full detail chunks
+#define TRACK_LOD_LEVELS 2
 
-#define VERTEX0 3
-#define VERTEX1 1
-#define VERTEX2 0
-#define VERTEX3 2
+// a track face on its way through the lods, corners in the order of addTrackFace
+struct LodFace
+{
+	float position[4][3];
+	float uv[4][2];
+	int	  texture;
+	Color color;
+	int	  span;		// faces of the full detail track it covers along the track
+	float error;	// largest distance of a dropped vertex from the faces that replace it
+};
 
-#if DEBUG_OUTPUT
-		std::cout << "Writing polygons..." << "\n";
-#endif
+struct LodGroup
+{
+	size_t				 first;	// sections first..last
+	size_t				 last;
+	std::vector<LodFace> faces;
+};
 
-		obj << "s off" << "\n";
-		
-		// write polygons... sigh
-		for ( size_t p = 0; p < objects[o].polygons.size(); p++ )
-		{
-#if SPRITES_OBJ
-			if ( objects[o].polygons[p].type == SPRITE_TOP_ANCHOR )
-			{
+float pointSegmentDistance( const float *p, const float *a, const float *b )
+{
+	float ab[3], ap[3];
+	for ( int k = 0; k < 3; k++ )
+	{
+		ab[k] = b[k] - a[k];
+		ap[k] = p[k] - a[k];
+	}
+	float length = ab[0] * ab[0] + ab[1] * ab[1] + ab[2] * ab[2];
+	float t = length > 0 ? std::min( std::max( ( ap[0] * ab[0] + ap[1] * ab[1] + ap[2] * ab[2] ) / length, 0.0f ), 1.0f ) : 0.0f;
 
-				Vertex32 vertex = objects[o].vertices[objects[o].polygons[p].polygon0x0A.index];
-				Color vertexcolor = int32ToColor( objects[o].polygons[p].polygon0x0A.color );
-				uint16_t tex = objects[o].polygons[p].polygon0x0A.texture;
-				uint16_t width = objects[o].polygons[p].polygon0x0A.width;
-				uint16_t height = objects[o].polygons[p].polygon0x0A.height;
+	float d = 0;
+	for ( int k = 0; k < 3; k++ )
+	{
+		float e = ap[k] - ab[k] * t;
+		d += e * e;
+	}
+	return sqrtf( d );
+}
 
-				spr << "o sprite_" << sprindex << "\n";
-				spr << "v " << vertex.x << " " << vertex.y << " " << vertex.z << "\n";
-				spr << "# color:" << vertexcolor.r << " " << vertexcolor.g << " " << vertexcolor.b << "\n";
-				spr << "# texture:" << tex << "\n";
-				spr << "# width:" << width << "\n";
-				spr << "# height:" << height << "\n";
-				sprindex++;
-			}
-			if ( objects[o].polygons[p].type == SPRITE_BOTTOM_ANCHOR )
+bool samePosition( const float *a, const float *b )
+{
+	return a[0] == b[0] && a[1] == b[1] && a[2] == b[2];
+}
+
+std::vector<LodGroup> trackLodSections( const Track &theTrack )
+{
+	std::vector<LodGroup> groups( theTrack.sections.size() );
+
+	for ( size_t s = 0; s < theTrack.sections.size(); s++ )
+	{
+		groups[s].first = groups[s].last = s;
+
+		const TrackSection &section = theTrack.sections[s];
+		size_t last = std::min( (size_t)section.firstFace + section.numFaces, theTrack.faces.size() );
+		for ( size_t i = section.firstFace; i < last; i++ )
+		{
+			const TrackFace &face = theTrack.faces[i];
+			float flipx = ( face.flags & FLIP ) ? 1.0f : 0.0f;
+			const float u[4] = { 1 - flipx, flipx, flipx, 1 - flipx };
+			const float v[4] = { 1, 1, 0, 0 };
+
+			LodFace lod;
+			bool bValid = true;
+			for ( int k = 0; k < 4 && bValid; k++ )
 			{
+				int index = face.indices[3 - k];
+				bValid = index >= 0 && index < (int)theTrack.vertices.size();
+				if ( !bValid )
+					break;
 
-				Vertex32 vertex = objects[o].vertices[objects[o].polygons[p].polygon0x0B.index];
-				Color vertexcolor = int32ToColor( objects[o].polygons[p].polygon0x0B.color );
-				uint16_t tex = objects[o].polygons[p].polygon0x0B.texture;
-				uint16_t width = objects[o].polygons[p].polygon0x0B.width;
-				uint16_t height = objects[o].polygons[p].polygon0x0B.height;
-						
-				spr << "o sprite_" << sprindex << "\n";
-				spr << "v " << vertex.x << " " << vertex.y << " " << vertex.z << "\n";
-				spr << "# color:" << vertexcolor.r << " " << vertexcolor.g << " " << vertexcolor.b << "\n";
-				spr << "# texture:" << filename << tex << "\n";
-				spr << "# width:" << width << "\n";
-				spr << "# height:" << height << "\n";
-				sprindex++;
+				lod.position[k][0] = (float)theTrack.vertices[index].x;
+				lod.position[k][1] = (float)theTrack.vertices[index].y;
+				lod.position[k][2] = (float)theTrack.vertices[index].z;
+				lod.uv[k][0] = u[k];
+				lod.uv[k][1] = v[k];
 			}
-#endif
-			if ( objects[o].polygons[p].type == FLAT_TRIS_FACE_COLOR )
-			{
-				bool degenerate = false;
+			if ( !bValid )
+				continue;
+
+			lod.texture = face.tile < theTrack.images.size() ? face.tile : -1;
+			lod.color = trackFaceColor( face );
+			lod.span = 1;
+			lod.error = 0;
+			groups[s].faces.push_back( lod );
+		}
+	}
 
-				for ( int i = 0; i < 3; i++ )
-				{
-					for ( int j = 0; j < 3; j++ )
-					{
-						if ( j != i && objects[o].polygons[p].polygon0x01.indices[i] == objects[o].polygons[p].polygon0x01.indices[j] )
-						{
-#if DEGENERATES_OBJ
-							degenerate = true;
-#else
-							degenerate = false;
-#endif
-						}
-					}
-				}
+	return groups;
+}
 
-				if ( !degenerate )
-				{
-#if MTL_OBJ
-					obj << "usemtl dummy" << "\n";
-#endif
+// every face of a is stretched over the face of b that shares an edge with it, the rest is kept as it is
+LodGroup mergeLodGroups( const LodGroup &a, const LodGroup &b )
+{
+	LodGroup merged;
+	merged.first = a.first;
+	merged.last = b.last;
 
-					obj << "f " 
-						<< std::to_string( objects[o].polygons[p].polygon0x01.indices[VERTEX3] + 1 + currentvertexindex )
-						<< "/" 
-						<< "/"  
-						<< " " ;
-					obj << std::to_string( objects[o].polygons[p].polygon0x01.indices[VERTEX1] + 1 + currentvertexindex )
-						<< "/" 
-						<< "/"  
-						<< " " ;
-					obj << std::to_string( objects[o].polygons[p].polygon0x01.indices[VERTEX2] + 1 + currentvertexindex )
-						<< "/" 
-						<< "/"  
-						<< " " ;
-					obj << "\n";
+	std::vector<bool> bUsed( b.faces.size(), false );
 
-					obj << "#fvcolorindex " << 
-						std::to_string(coloroffset + currentvertexcolorindex)
-						<< " " << 
-						std::to_string(coloroffset + currentvertexcolorindex)
-						<< " " << 
-						std::to_string(coloroffset + currentvertexcolorindex)
-						<< "\n";
+	for ( size_t f = 0; f < a.faces.size(); f++ )
+	{
+		LodFace face = a.faces[f];
+		bool bMerged = false;
 
-					coloroffset++;
-				}
-			}
-			if ( objects[o].polygons[p].type == TEXTURED_TRIS_FACE_COLOR )
-			{
-				bool degenerate = false;
+		for ( size_t g = 0; g < b.faces.size() && !bMerged; g++ )
+		{
+			if ( bUsed[g] )
+				continue;
 
-				for ( int i = 0; i < 3; i++ )
+			const LodFace &next = b.faces[g];
+			for ( int i = 0; i < 4 && !bMerged; i++ )
+			{
+				int i1 = ( i + 1 ) % 4;
+				for ( int j = 0; j < 4 && !bMerged; j++ )
 				{
-					for ( int j = 0; j < 3; j++ )
+					int j1 = ( j + 1 ) % 4;
+					if ( !samePosition( face.position[i], next.position[j1] ) || !samePosition( face.position[i1], next.position[j] ) )
+						continue;
+
+					// the shared edge i..i1 moves to the far edge of next, the corner beyond j1 and the one before j
+					const int corners[2] = { i, i1 };
+					const int kept[2] = { ( i + 3 ) % 4, ( i + 2 ) % 4 };
+					const int far[2] = { ( j1 + 1 ) % 4, ( j + 3 ) % 4 };
+					float scale = (float)( face.span + next.span ) / face.span;
+
+					float error = std::max( face.error, next.error );
+					for ( int c = 0; c < 2; c++ )
 					{
-						if ( j != i && objects[o].polygons[p].polygon0x02.indices[i] == objects[o].polygons[p].polygon0x02.indices[j] )
-						{
-#if DEGENERATES_OBJ
-							degenerate = true;
-#else
-							degenerate = false;
-#endif
-						}
+						const float *moved = next.position[far[c]];
+						error = std::max( error, pointSegmentDistance( face.position[corners[c]], face.position[kept[c]], moved ) );
+						for ( int k = 0; k < 2; k++ )
+							face.uv[corners[c]][k] = face.uv[kept[c]][k] + ( face.uv[corners[c]][k] - face.uv[kept[c]][k] ) * scale;
+						memcpy( face.position[corners[c]], moved, sizeof(face.position[0]) );
 					}
+
+					face.span += next.span;
+					face.error = error;
+					bUsed[g] = true;
+					bMerged = true;
 				}
+			}
+		}
 
-				if ( !degenerate )
-				{
-#if MTL_OBJ
-					obj << "usemtl " << filename << std::to_string(objects[o].polygons[p].polygon0x02.texture) << "\n";
-#endif
+		merged.faces.push_back( face );
+	}
 
-					obj << "f " 
-						<< std::to_string( objects[o].polygons[p].polygon0x02.indices[VERTEX3] + 1 + currentvertexindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + VERTEX3 + currentvertexcoordindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + VERTEX3 + currentvertexcoordindex )
-						<< " " ;
-					obj << std::to_string( objects[o].polygons[p].polygon0x02.indices[VERTEX1] + 1 + currentvertexindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + VERTEX1 + currentvertexcoordindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + VERTEX2 + currentvertexcoordindex ) 
-						<< " " ;
-					obj << std::to_string( objects[o].polygons[p].polygon0x02.indices[VERTEX2] + 1 + currentvertexindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + currentvertexcoordindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + currentvertexcoordindex ) 
-						<< " " ;
-					obj << "\n";
+	for ( size_t g = 0; g < b.faces.size(); g++ )
+	{
+		if ( !bUsed[g] )
+			merged.faces.push_back( b.faces[g] );
+	}
 
-					obj << "#fvcolorindex " << 
-						std::to_string(coloroffset + currentvertexcolorindex)
-						<< " " << 
-						std::to_string(coloroffset + currentvertexcolorindex)
-						<< " " << 
-						std::to_string(coloroffset + currentvertexcolorindex)
-						<< "\n";
+	return merged;
+}
 
-					coloroffset++;
-					texcoordoffset += 3;
-				}
-			}
-			if ( objects[o].polygons[p].type == FLAT_QUAD_FACE_COLOR )
-			{
-				bool degenerate = false;
+// pairs of neighbouring groups are joined when the first leads into the second and both are in the
+// same lod chunk, so no group crosses a chunk boundary
+std::vector<LodGroup> nextTrackLod( const Track &theTrack, const std::vector<LodGroup> &groups, size_t sectionsPerChunk )
+{
+	std::vector<LodGroup> coarser;
 
-				for ( int i = 0; i < 4; i++ )
-				{
-					for ( int j = 0; j < 4; j++ )
-					{
-						if ( j != i && objects[o].polygons[p].polygon0x04.indices[i] == objects[o].polygons[p].polygon0x04.indices[j] )
-						{
-#if DEGENERATES_OBJ
-							degenerate = true;
-#else
-							degenerate = false;
-#endif
-						}
-					}
-				}
+	for ( size_t i = 0; i < groups.size(); )
+	{
+		bool bJoin = i + 1 < groups.size()
+			&& groups[i].first / sectionsPerChunk == groups[i + 1].last / sectionsPerChunk
+			&& theTrack.sections[groups[i].last].next == (int32_t)groups[i + 1].first;
 
-				if ( !degenerate )
-				{
-#if MTL_OBJ
-					obj << "usemtl dummy" << "\n";
-#endif
+		// a group left alone doesn't take its neighbour with it, that one may still pair with the next
+		if ( bJoin )
+		{
+			coarser.push_back( mergeLodGroups( groups[i], groups[i + 1] ) );
+			i += 2;
+		}
+		else
+		{
+			coarser.push_back( groups[i] );
+			i++;
+		}
+	}
 
-					obj << "f " 
-						<< std::to_string( objects[o].polygons[p].polygon0x03.indices[VERTEX0] + 1 + currentvertexindex )
-						<< "/" 
-						<< "/"  
-						<< " " ;
-					obj << std::to_string( objects[o].polygons[p].polygon0x03.indices[VERTEX1] + 1 + currentvertexindex )
-						<< "/" 
-						<< "/"  
-						<< " " ;
-					obj << std::to_string( objects[o].polygons[p].polygon0x03.indices[VERTEX2] + 1 + currentvertexindex )
-						<< "/" 
-						<< "/"  
-						<< " " ;
-					obj << std::to_string( objects[o].polygons[p].polygon0x03.indices[VERTEX3] + 1 + currentvertexindex )
-						<< "/" 
-						<< "/"  
-						<< " " ;
-					obj << "\n";
+	return coarser;
+}
 
-					obj << "#fvcolorindex " << 
-						std::to_string(coloroffset + currentvertexcolorindex)
-						<< " " << 
-						std::to_string(coloroffset + currentvertexcolorindex)
-						<< " " << 
-						std::to_string(coloroffset + currentvertexcolorindex)
-						<< " " << 
-						std::to_string(coloroffset + currentvertexcolorindex)
-						<< "\n";
+// one .obj per chunk and level next to the full detail chunks, the lod textures and a manifest
+void writeTrackLods( const Track &theTrack, const std::string &path )
+{
+	printText( "Writing track lods ..." );
 
-					coloroffset++;
-				}
-			}
-			if ( objects[o].polygons[p].type == TEXTURED_QUAD_FACE_COLOR )
-			{
-				bool degenerate = false;
+	size_t chunkSections = std::max( options.chunkSections, (size_t)1 );
+	size_t chunksPerLod = ( ( (size_t)1 << TRACK_LOD_LEVELS ) + chunkSections - 1 ) / chunkSections;
+	size_t sectionsPerChunk = chunksPerLod * chunkSections;
+	const char *prefixes[2] = { "track_medium_", "track_far_" };
 
-				for ( int i = 0; i < 4; i++ )
-				{
-					for ( int j = 0; j < 4; j++ )
-					{
-						if ( j != i && objects[o].polygons[p].polygon0x04.indices[i] == objects[o].polygons[p].polygon0x04.indices[j] )
-						{
-#if DEGENERATES_OBJ
-							degenerate = true;
-#else
-							degenerate = false;
-#endif
-						}
-					}
-				}
+	writeObjectImages( theTrack.mediumImages, prefixes[0], path.c_str() );
+	writeObjectImages( theTrack.farImages, prefixes[1], path.c_str() );
 
-				if ( !degenerate )
-				{
-#if MTL_OBJ
-					obj << "usemtl " << filename << std::to_string(objects[o].polygons[p].polygon0x04.texture) << "\n";
-#endif
+	ObjWriter mtl( path + "track_lods.mtl", 64 * 1024 );
+	for ( int p = 0; p < 2; p++ )
+	{
+		for ( size_t i = 0; i < theTrack.textureIndex.size(); i++ )
+		{
+			mtl << "newmtl " << prefixes[p] << i << "\n";
+			mtl << "map_Kd " << prefixes[p] << i << ".tga" << "\n" << "\n";
+		}
+	}
+	mtl.close();
 
-					obj << "f " 
-						<< std::to_string( objects[o].polygons[p].polygon0x04.indices[VERTEX0] + 1 + currentvertexindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + VERTEX0 + currentvertexcoordindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + VERTEX0 + currentvertexcoordindex )
-						<< " " ;
-					obj << std::to_string( objects[o].polygons[p].polygon0x04.indices[VERTEX1] + 1 + currentvertexindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + VERTEX1 + currentvertexcoordindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + VERTEX1 + currentvertexcoordindex )
-						<< " " ;
-					obj << std::to_string( objects[o].polygons[p].polygon0x04.indices[VERTEX2] + 1 + currentvertexindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + VERTEX2 + currentvertexcoordindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + VERTEX2 + currentvertexcoordindex )
-						<< " " ;
-					obj << std::to_string( objects[o].polygons[p].polygon0x04.indices[VERTEX3] + 1 + currentvertexindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + VERTEX3 + currentvertexcoordindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + VERTEX3 + currentvertexcoordindex )
-						<< " " ;
-					obj << "\n";
+	ObjWriter json( path + "track_lods.json", 64 * 1024 );
+	json << "{" << "\n";
+	json << "\t\"sectionsPerChunk\": " << sectionsPerChunk << "," << "\n";
+	json << "\t\"fullDetailChunksPerChunk\": " << chunksPerLod << "," << "\n";
+	json << "\t\"levels\": [" << "\n";
 
-					obj << "#fvcolorindex " << 
-						std::to_string(coloroffset + currentvertexcolorindex)
-						<< " " << 
-						std::to_string(coloroffset + currentvertexcolorindex)
-						<< " " << 
-						std::to_string(coloroffset + currentvertexcolorindex)
-						<< " " << 
-						std::to_string(coloroffset + currentvertexcolorindex)
-						<< "\n";
+	std::vector<LodGroup> groups = trackLodSections( theTrack );
+	size_t fullTriangles = 0;
+	for ( size_t i = 0; i < groups.size(); i++ )
+		fullTriangles += groups[i].faces.size() * 2;
 
-					coloroffset++;
-					texcoordoffset += 4;
-				}
-			}
-			if ( objects[o].polygons[p].type == FLAT_TRIS_VERTEX_COLOR )
-			{
-				bool degenerate = false;
+	for ( int level = 1; level <= TRACK_LOD_LEVELS; level++ )
+	{
+		groups = nextTrackLod( theTrack, groups, sectionsPerChunk );
+		const char *prefix = prefixes[std::min( level, 2 ) - 1];
+
+		// groups go to the chunk their first section is in
+		size_t chunkCount = ( theTrack.sections.size() + sectionsPerChunk - 1 ) / sectionsPerChunk;
+		std::vector<std::vector<size_t>> chunkGroups( chunkCount );
+		for ( size_t i = 0; i < groups.size(); i++ )
+			chunkGroups[groups[i].first / sectionsPerChunk].push_back( i );
 
-				for ( int i = 0; i < 3; i++ )
+		std::vector<std::string> filenames( chunkCount );
+		std::vector<size_t> triangles( chunkCount, 0 );
+		std::vector<float> errors( chunkCount, 0 );
+
+		parallelFor( chunkCount, [&]( size_t c )
+		{
+			if ( chunkGroups[c].empty() )
+				return;
+
+			const TrackSection &first = theTrack.sections[c * sectionsPerChunk];
+			Mesh mesh;
+			mesh.name = "chunk_" + std::to_string( c ) + "_lod" + std::to_string( level );
+			mesh.translation = { (float)first.x, (float)first.y, (float)first.z };
+			std::vector<int> primitiveOf;
+
+			for ( size_t g = 0; g < chunkGroups[c].size(); g++ )
+			{
+				const LodGroup &group = groups[chunkGroups[c][g]];
+				for ( size_t f = 0; f < group.faces.size(); f++ )
 				{
-					for ( int j = 0; j < 3; j++ )
+					const LodFace &face = group.faces[f];
+					MeshVertex corners[4];
+					for ( int k = 0; k < 4; k++ )
 					{
-						if ( j != i && objects[o].polygons[p].polygon0x05.indices[i] == objects[o].polygons[p].polygon0x05.indices[j] )
-						{
-#if DEGENERATES_OBJ
-							degenerate = true;
-#else
-							degenerate = false;
-#endif
-						}
+						corners[k] = meshVertex( face.position[k][0] - mesh.translation.x, face.position[k][1] - mesh.translation.y, face.position[k][2] - mesh.translation.z,
+							face.uv[k][0], face.uv[k][1], face.color );
 					}
+					addMeshFace( mesh, primitiveOf, face.texture, corners, 4 );
+					triangles[c] += 2;
+					errors[c] = std::max( errors[c], face.error );
 				}
+			}
 
-				if ( !degenerate )
-				{
-#if MTL_OBJ
-					obj << "usemtl dummy" << "\n";
-#endif
+			char name[48];
+			snprintf( name, sizeof(name), "track_chunk_%04d_lod%d.obj", (int)c, level );
+			filenames[c] = name;
 
-					obj << "f " 
-						<< std::to_string( objects[o].polygons[p].polygon0x05.indices[VERTEX3] + 1 + currentvertexindex )
-						<< "/" 
-						<< "/"  
-						<< " " ;
-					obj << std::to_string( objects[o].polygons[p].polygon0x05.indices[VERTEX1] + 1 + currentvertexindex )
-						<< "/" 
-						<< "/"  
-						<< " " ;
-					obj << std::to_string( objects[o].polygons[p].polygon0x05.indices[VERTEX2] + 1 + currentvertexindex )
-						<< "/" 
-						<< "/"  
-						<< " " ;
-					obj << "\n";
+			ObjWriter obj( path + name, 256 * 1024 );
+			obj << "mtllib track_lods.mtl" << "\n";
+			writeMeshOBJ( obj, mesh, splitObjStreams( mesh ), prefix, false, ObjIndexBase() );
+		} );
 
-					obj << "#fvcolorindex " << 
-						std::to_string(coloroffset + 2 + currentvertexcolorindex)
-						<< " " << 
-						std::to_string(coloroffset + 1 + currentvertexcolorindex)
-						<< " " << 
-						std::to_string(coloroffset + currentvertexcolorindex)
-						<< "\n";
+		size_t levelTriangles = 0;
+		float levelError = 0;
+		json << "\t\t{ \"level\": " << level << ", \"chunks\": [" << "\n";
+		bool bFirst = true;
+		for ( size_t c = 0; c < chunkCount; c++ )
+		{
+			if ( filenames[c].empty() )
+				continue;
 
-					coloroffset += 3;
-				}
-			}
-			if ( objects[o].polygons[p].type == TEXTURED_TRIS_VERTEX_COLOR )
-			{
-				bool degenerate = false;
+			const LodGroup &last = groups[chunkGroups[c].back()];
+			json << ( bFirst ? "" : ",\n" ) << "\t\t\t{ \"chunk\": " << c << ", \"file\": \"" << filenames[c] << "\""
+				<< ", \"firstSection\": " << groups[chunkGroups[c][0]].first << ", \"lastSection\": " << last.last
+				<< ", \"triangles\": " << triangles[c] << ", \"error\": " << errors[c] << " }";
+			bFirst = false;
 
-				for ( int i = 0; i < 3; i++ )
-				{
-					for ( int j = 0; j < 3; j++ )
-					{
-						if ( j != i && objects[o].polygons[p].polygon0x06.indices[i] == objects[o].polygons[p].polygon0x06.indices[j] )
-						{
-#if DEGENERATES_OBJ
-							degenerate = true;
-#else
-							degenerate = false;
-#endif
-						}
-					}
-				}
+			levelTriangles += triangles[c];
+			levelError = std::max( levelError, errors[c] );
+		}
+		json << "\n" << "\t\t], \"triangles\": " << levelTriangles << ", \"error\": " << levelError << " }" << ( level < TRACK_LOD_LEVELS ? "," : "" ) << "\n";
 
-				if ( !degenerate )
-				{
-#if MTL_OBJ
-					obj << "usemtl " << filename << std::to_string(objects[o].polygons[p].polygon0x06.texture) << "\n";
-#endif
-					obj << "f " 
-						<< std::to_string( objects[o].polygons[p].polygon0x06.indices[VERTEX3] + 1 + currentvertexindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + VERTEX3 + currentvertexcoordindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + VERTEX3 + currentvertexcoordindex )
-						<< " " ;
-					obj << std::to_string( objects[o].polygons[p].polygon0x06.indices[VERTEX1] + 1 + currentvertexindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + VERTEX1 + currentvertexcoordindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + VERTEX1 + currentvertexcoordindex )
-						<< " " ;
-					obj << std::to_string( objects[o].polygons[p].polygon0x06.indices[VERTEX2] + 1 + currentvertexindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + VERTEX2 + currentvertexcoordindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + VERTEX2 + currentvertexcoordindex )
-						<< " " ;
-					obj << "\n";
+		printLine( "track lod", level, ": ", levelTriangles, " triangles (full detail ", fullTriangles, "), max error ", levelError );
+	}
 
-					obj << "#fvcolorindex " << 
-						std::to_string(coloroffset + 2 + currentvertexcolorindex)
-						<< " " << 
-						std::to_string(coloroffset + 1 + currentvertexcolorindex)
-						<< " " << 
-						std::to_string(coloroffset + currentvertexcolorindex)
-						<< "\n";
+	json << "\t]" << "\n";
+	json << "}" << "\n";
+	json.close();
+}
 
-					coloroffset += 3;
-					texcoordoffset += 3;
-				}
-			}
-			if ( objects[o].polygons[p].type == FLAT_QUAD_VERTEX_COLOR )
-			{
-				bool degenerate = false;
+//
+// track queries
+//
 
-				for ( int i = 0; i < 4; i++ )
-				{
-					for ( int j = 0; j < 4; j++ )
-					{
-						if ( j != i && objects[o].polygons[p].polygon0x07.indices[i] == objects[o].polygons[p].polygon0x07.indices[j] )
-						{
-#if DEGENERATES_OBJ
-							degenerate = true;
-#else
-							degenerate = false;
-#endif
-						}
-					}
-				}
+void writeTrackBVH( const TrackBVH &bvh, const char *filename )
+{
+	printText( "Writing BVH file ..." );
 
-				if ( !degenerate )
-				{
-#if MTL_OBJ
-					obj << "usemtl dummy" << "\n";
-#endif
+	if ( !bvh.save( filename ) )
+		printLine( "Error! could not write ", filename );
+	else
+		printLine( filename, ": ", bvh.faces.size(), " faces, ", bvh.nodes.size(), " nodes" );
+}
 
-					obj << "f " 
-						<< std::to_string( objects[o].polygons[p].polygon0x07.indices[VERTEX0] + 1 + currentvertexindex )
-						<< "/" 
-						<< "/"  
-						<< " " ;
-					obj << std::to_string( objects[o].polygons[p].polygon0x07.indices[VERTEX1] + 1 + currentvertexindex )
-						<< "/" 
-						<< "/"  
-						<< " " ;
-					obj << std::to_string( objects[o].polygons[p].polygon0x07.indices[VERTEX2] + 1 + currentvertexindex )
-						<< "/" 
-						<< "/"  
-						<< " " ;
-					obj << std::to_string( objects[o].polygons[p].polygon0x07.indices[VERTEX3] + 1 + currentvertexindex )
-						<< "/" 
-						<< "/"  
-						<< " " ;
-					obj << "\n";
+// pvs samples sit on the faces, the viewers are lifted this far off the surface, the targets a little
+#define PVS_EYE_HEIGHT 200.0f
+#define PVS_TARGET_HEIGHT 16.0f
 
-					obj << "#fvcolorindex " << 
-						std::to_string(coloroffset + 3 + currentvertexcolorindex)
-						<< " " << 
-						std::to_string(coloroffset + 1 + currentvertexcolorindex)
-						<< " " << 
-						std::to_string(coloroffset + 0 + currentvertexcolorindex)
-						<< " " << 
-						std::to_string(coloroffset + 2 + currentvertexcolorindex)
-						<< "\n";
+// face centres moved along the face normal, the stored normal only decides which side is inside the track
+// with bOutline every corner and edge midpoint of the section is added too, moved along the average
+// normal of the faces sharing it, so faces with a hidden centre but a visible edge are still found
+std::vector<Vectorf> pvsSamples( const Track &theTrack, const TrackSection &section, float height, bool bOutline )
+{
+	std::vector<Vectorf> samples;
 
-					coloroffset += 4;
-				}
-			}
-			if ( objects[o].polygons[p].type == TEXTURED_QUAD_VERTEX_COLOR )
+	// position sum, normal sum and face count of every corner (a, -1) and edge (a, b) with a < b
+	std::map<std::pair<int, int>, std::pair<std::pair<Vectorf, Vectorf>, int>> outline;
+
+	size_t last = std::min( (size_t)section.firstFace + section.numFaces, theTrack.faces.size() );
+	for ( size_t i = section.firstFace; i < last; i++ )
+	{
+		const TrackFace &face = theTrack.faces[i];
+		float corners[4][3];
+		bool bValid = true;
+		for ( int k = 0; k < 4 && bValid; k++ )
+		{
+			int index = face.indices[k];
+			bValid = index >= 0 && index < (int)theTrack.vertices.size();
+			if ( bValid )
 			{
-				bool degenerate = false;
+				corners[k][0] = (float)theTrack.vertices[index].x;
+				corners[k][1] = (float)theTrack.vertices[index].y;
+				corners[k][2] = (float)theTrack.vertices[index].z;
+			}
+		}
+		if ( !bValid )
+			continue;
 
-				for ( int i = 0; i < 4; i++ )
-				{
-					for ( int j = 0; j < 4; j++ )
-					{
-						if ( j != i && objects[o].polygons[p].polygon0x08.indices[i] == objects[o].polygons[p].polygon0x08.indices[j] )
-						{
-#if DEGENERATES_OBJ
-							degenerate = true;
-#else
-							degenerate = false;
-#endif
-						}
-					}
-				}
+		float diagonal0[3], diagonal1[3], normal[3];
+		bvh_sub( diagonal0, corners[2], corners[0] );
+		bvh_sub( diagonal1, corners[3], corners[1] );
+		bvh_cross( normal, diagonal0, diagonal1 );
 
-				if ( !degenerate )
-				{
-#if MTL_OBJ
-					obj << "usemtl " << filename << std::to_string(objects[o].polygons[p].polygon0x08.texture) << "\n";
-#endif
-					obj << "f " 
-						<< std::to_string( objects[o].polygons[p].polygon0x08.indices[VERTEX0] + 1 + currentvertexindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + VERTEX0 + currentvertexcoordindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + VERTEX0 + currentvertexcoordindex )
-						<< " " ;
-					obj << std::to_string( objects[o].polygons[p].polygon0x08.indices[VERTEX1] + 1 + currentvertexindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + VERTEX1 + currentvertexcoordindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + VERTEX1 + currentvertexcoordindex )
-						<< " " ;
-					obj << std::to_string( objects[o].polygons[p].polygon0x08.indices[VERTEX2] + 1 + currentvertexindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + VERTEX2 + currentvertexcoordindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + VERTEX2 + currentvertexcoordindex )
-						<< " " ;
-					obj << std::to_string( objects[o].polygons[p].polygon0x08.indices[VERTEX3] + 1 + currentvertexindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + VERTEX3 + currentvertexcoordindex )
-						<< "/" 
-						<< std::to_string( texcoordoffset + VERTEX3 + currentvertexcoordindex )
-						<< " " ;
-					obj << "\n";
+		float length = sqrtf( bvh_dot( normal, normal ) );
+		if ( length == 0 )
+			continue;
 
-					obj << "#fvcolorindex " << 
-						std::to_string(coloroffset + 3 + currentvertexcolorindex)
-						<< " " << 
-						std::to_string(coloroffset + 1 + currentvertexcolorindex)
-						<< " " << 
-						std::to_string(coloroffset + 0 + currentvertexcolorindex)
-						<< " " << 
-						std::to_string(coloroffset + 2 + currentvertexcolorindex)
-						<< "\n";
+		const float stored[3] = { (float)face.normalx, (float)face.normaly, (float)face.normalz };
+		float scale = ( bvh_dot( normal, stored ) < 0 ? -1.0f : 1.0f ) / length;
+		const Vectorf unit = { normal[0] * scale, normal[1] * scale, normal[2] * scale };
 
-					coloroffset += 4;
-					texcoordoffset += 4;
+		Vectorf sample;
+		sample.x = ( corners[0][0] + corners[1][0] + corners[2][0] + corners[3][0] ) * 0.25f + unit.x * height;
+		sample.y = ( corners[0][1] + corners[1][1] + corners[2][1] + corners[3][1] ) * 0.25f + unit.y * height;
+		sample.z = ( corners[0][2] + corners[1][2] + corners[2][2] + corners[3][2] ) * 0.25f + unit.z * height;
+		samples.push_back( sample );
+
+		if ( !bOutline )
+			continue;
+
+		auto add = [&]( int a, int b, const float *position )
+		{
+			auto &entry = outline[std::make_pair( a, b )];
+			entry.first.first.x += position[0];
+			entry.first.first.y += position[1];
+			entry.first.first.z += position[2];
+			entry.first.second.x += unit.x;
+			entry.first.second.y += unit.y;
+			entry.first.second.z += unit.z;
+			entry.second++;
+		};
+
+		for ( int k = 0; k < 4; k++ )
+		{
+			int j = ( k + 1 ) % 4;
+			const float middle[3] = { ( corners[k][0] + corners[j][0] ) * 0.5f, ( corners[k][1] + corners[j][1] ) * 0.5f, ( corners[k][2] + corners[j][2] ) * 0.5f };
+			add( face.indices[k], -1, corners[k] );
+			add( std::min( face.indices[k], face.indices[j] ), std::max( face.indices[k], face.indices[j] ), middle );
+		}
+	}
+
+	for ( auto entry = outline.begin(); entry != outline.end(); ++entry )
+	{
+		const Vectorf &sum = entry->second.first.first;
+		const Vectorf &normal = entry->second.first.second;
+		float count = (float)entry->second.second;
+		float length = sqrtf( normal.x * normal.x + normal.y * normal.y + normal.z * normal.z );
+		float lift = length > 0 ? height / length : 0;
+
+		samples.push_back( { sum.x / count + normal.x * lift, sum.y / count + normal.y * lift, sum.z / count + normal.z * lift } );
+	}
+
+	return samples;
+}
+
+// row s has bit t set when section t may be visible from section s, rowBytes bytes per row
+// a section sees another when any ray from its face centres to the other's centres, corners and edge
+// midpoints gets through. On top of that the linked sections always count as visible, every row also
+// gets the links of the sections it sees and the table is made symmetric. It is still sampled, so it
+// is approximate: it leans visible, but a section seen only between samples can be missed
+std::vector<uint8_t> buildTrackPVS( const Track &theTrack, const TrackBVH &bvh, size_t &rowBytes )
+{
+	size_t count = theTrack.sections.size();
+	rowBytes = ( count + 7 ) / 8;
+	std::vector<uint8_t> pvs( rowBytes * count, 0 );
+
+	std::vector<int32_t> sectionOf( theTrack.faces.size(), -1 );
+	std::vector<std::vector<Vectorf>> viewers( count ), targets( count );
+	for ( size_t s = 0; s < count; s++ )
+	{
+		const TrackSection &section = theTrack.sections[s];
+		size_t last = std::min( (size_t)section.firstFace + section.numFaces, theTrack.faces.size() );
+		for ( size_t i = section.firstFace; i < last; i++ )
+			sectionOf[i] = (int32_t)s;
+
+		viewers[s] = pvsSamples( theTrack, section, PVS_EYE_HEIGHT, false );
+		targets[s] = pvsSamples( theTrack, section, PVS_TARGET_HEIGHT, true );
+	}
+
+	auto set = [&]( size_t from, int32_t to )
+	{
+		if ( to >= 0 && (size_t)to < count )
+			pvs[from * rowBytes + to / 8] |= (uint8_t)( 1 << ( to % 8 ) );
+	};
+
+	parallelFor( count, [&]( size_t s )
+	{
+		set( s, (int32_t)s );
+		set( s, theTrack.sections[s].next );
+		set( s, theTrack.sections[s].previous );
+		set( s, theTrack.sections[s].nextJunction );
+
+		for ( size_t t = 0; t < count; t++ )
+		{
+			bool bVisible = ( pvs[s * rowBytes + t / 8] >> ( t % 8 ) ) & 1;
+
+			for ( size_t v = 0; v < viewers[s].size() && !bVisible; v++ )
+			{
+				for ( size_t g = 0; g < targets[t].size() && !bVisible; g++ )
+				{
+					const float *origin = &viewers[s][v].x;
+					const float direction[3] = { targets[t][g].x - origin[0], targets[t][g].y - origin[1], targets[t][g].z - origin[2] };
+
+					// anything hit before the target that isn't the target section blocks the view
+					float hitT;
+					int32_t face = bvh.raycast( origin, direction, hitT, 1.0f );
+					bVisible = face < 0 || sectionOf[face] == (int32_t)t;
 				}
 			}
+
+			if ( bVisible )
+				set( s, (int32_t)t );
 		}
+	} );
 
-#if !MERGED_OBJ
-#if DEBUG_OUTPUT
-			printText("Writing MTL file ...");
-#endif
-			std::ofstream mtl( mtlname );
-	
-			for ( size_t i = 0; i < images.size(); i++ )
+	auto visible = [&]( const std::vector<uint8_t> &table, size_t from, size_t to )
+	{
+		return ( ( table[from * rowBytes + to / 8] >> ( to % 8 ) ) & 1 ) != 0;
+	};
+
+	auto symmetrise = [&]()
+	{
+		for ( size_t s = 0; s < count; s++ )
+		{
+			for ( size_t t = s + 1; t < count; t++ )
 			{
-				mtl << "newmtl " << filename << std::to_string(i) << "\n";
-				mtl << "map_Kd " << filename << std::to_string(i) << ".tga" << "\n" << "\n";
+				if ( visible( pvs, s, t ) || visible( pvs, t, s ) )
+				{
+					set( s, (int32_t)t );
+					set( t, (int32_t)s );
+				}
 			}
+		}
+	};
 
-			mtl << "newmtl dummy" << "\n";
-			mtl << "map_Kd white.tga" << "\n" << "\n";	
+	// one step along the links from everything visible, from a copy so it doesn't spread further
+	symmetrise();
+	std::vector<uint8_t> sampled = pvs;
+	for ( size_t s = 0; s < count; s++ )
+	{
+		for ( size_t t = 0; t < count; t++ )
+		{
+			if ( !visible( sampled, s, t ) )
+				continue;
+			set( s, theTrack.sections[t].next );
+			set( s, theTrack.sections[t].previous );
+			set( s, theTrack.sections[t].nextJunction );
+		}
+	}
+	symmetrise();
 
-#if DEBUG_OUTPUT
-			printText("MTL file written successfully!");
-#endif
+	return pvs;
+}
 
-			obj.close();
-			mtl.close();
-#endif
+// "TPVS" | u32 version | u32 section count | u32 bytes per row | rows, bit t of row s is byte t / 8, bit t % 8
+void writeTrackPVS( const Track &theTrack, const TrackBVH &bvh, const char *filename )
+{
+	printText( "Writing PVS file ..." );
 
-#if DEBUG_OUTPUT
-		std::cout << "Object vertex count: " << std::to_string( objects[o].vertices.size()) << "\n";
+	size_t rowBytes = 0;
+	std::vector<uint8_t> pvs = buildTrackPVS( theTrack, bvh, rowBytes );
 
-		printText( "OBJ file written successfully!" );
-#endif
+	// the header is little endian whatever the host is
+	std::vector<uint8_t> out;
+	out.insert( out.end(), { 'T', 'P', 'V', 'S' } );
+	const uint32_t header[3] = { 1, (uint32_t)theTrack.sections.size(), (uint32_t)rowBytes };
+	for ( int i = 0; i < 3; i++ )
+	{
+		for ( int b = 0; b < 4; b++ )
+			out.push_back( (uint8_t)( header[i] >> ( b * 8 ) ) );
 	}
+	out.insert( out.end(), pvs.begin(), pvs.end() );
 
-#if MERGED_OBJ
-#if DEBUG_OUTPUT
-	printText("Writing MTL file ...");
+	FILE *fp = NULL;
+#ifdef _MSC_VER
+	fopen_s( &fp, filename, "wb" );
+#else
+	fp = fopen( filename, "wb" );
 #endif
+	if ( fp == NULL )
+	{
+		printLine( "Error! could not write ", filename );
+		return;
+	}
+	fwrite( out.data(), 1, out.size(), fp );
+	fclose( fp );
 
-	std::ofstream mtl( mtlname );
-	
-	for ( size_t i = 0; i < images.size(); i++ )
+	size_t visible = 0;
+	for ( size_t i = 0; i < pvs.size(); i++ )
 	{
-		mtl << "newmtl " << filename << std::to_string(i) << "\n";
-		mtl << "map_Kd " << filename << std::to_string(i) << ".tga" << "\n" << "\n";
+		for ( int b = 0; b < 8; b++ )
+			visible += ( pvs[i] >> b ) & 1;
 	}
+	printLine( filename, ": ", theTrack.sections.size(), " sections, ", ( theTrack.sections.size() ? (float)visible / theTrack.sections.size() : 0.0f ), " visible on average" );
+}
 
-	mtl << "newmtl dummy" << "\n";
-	mtl << "map_Kd white.tga" << "\n" << "\n";	
+// the centreline graph as .bin for the tools and .json to read
+void writeTrackGraph( const Track &theTrack, const std::string &path )
+{
+	printText( "Writing track graph ..." );
 
-#if DEBUG_OUTPUT
-	printText("MTL file written successfully!");
-#endif
+	TrackGraph graph;
+	graph.build( theTrack );
+
+	std::string filename = path + "track_graph.bin";
+	if ( !graph.save( filename.c_str() ) )
+	{
+		printLine( "Error! could not write ", filename );
+		return;
+	}
+
+	ObjWriter json( path + "track_graph.json", 64 * 1024 );
+	json << "{" << "\n";
+	json << "\t\"routes\": [" << "\n";
+	for ( size_t r = 0; r < graph.routes.size(); r++ )
+	{
+		const TrackRoute &route = graph.routes[r];
+		json << "\t\t{ \"length\": " << route.length << ", \"closed\": " << ( route.bClosed ? "true" : "false" )
+			<< ", \"start\": " << route.start << ", \"end\": " << route.end << ", \"sections\": [";
+		for ( size_t i = 0; i < route.sections.size(); i++ )
+			json << ( i ? ", " : "" ) << route.sections[i];
+		json << "] }" << ( r + 1 < graph.routes.size() ? "," : "" ) << "\n";
+	}
+	json << "\t]," << "\n";
 
-	obj.close();
-	mtl.close();
-#endif
+	json << "\t\"sections\": [" << "\n";
+	for ( size_t i = 0; i < graph.nodes.size(); i++ )
+	{
+		const TrackGraphNode &node = graph.nodes[i];
+		json << "\t\t{ \"position\": [" << lroundf( node.position[0] ) << ", " << lroundf( node.position[1] ) << ", " << lroundf( node.position[2] ) << "]"
+			<< ", \"next\": " << node.next << ", \"previous\": " << node.previous << ", \"nextJunction\": " << node.junction
+			<< ", \"flags\": " << node.flags << ", \"route\": " << node.route << ", \"distance\": " << node.distance
+			<< " }" << ( i + 1 < graph.nodes.size() ? "," : "" ) << "\n";
+	}
+	json << "\t]" << "\n";
+	json << "}" << "\n";
+	json.close();
+
+	if ( graph.routes.size() )
+		printLine( filename, ": ", graph.routes.size(), " routes, main loop ", graph.routes[0].length );
+	else
+		printLine( filename, ": 0 routes" );
 }
 
 //
-// track
+// batching
 //
 
+// objects are batched with the others in their cell that share a texture, and a batch stays small
+// enough for 16 bit indices in the .glb (65535 is the primitive restart value, so one short of 64k vertices)
+#define BATCH_CELL_SIZE 16384.0f
+#define BATCH_MAX_VERTICES 65535
 
-Track loadTrack( std::vector<Image> &images )
+struct ObjectBatch
 {
-	Track theTrack;
-	std::ifstream fileTextureIndex;
-	std::ifstream fileVertices;
-	std::ifstream fileFaces;
-	std::ifstream fileSections;
-	std::ifstream fileTrackTexture;
-
-	fileTextureIndex.open( "LIBRARY.TTF", std::ifstream::in | std::ifstream::binary );
-	fileVertices.open( "TRACK.TRV", std::ifstream::in | std::ifstream::binary );
-	fileFaces.open( "TRACK.TRF", std::ifstream::in | std::ifstream::binary );
-	fileSections.open( "TRACK.TRS", std::ifstream::in | std::ifstream::binary );
-	if ( bSequel )
-		fileTrackTexture.open( "TRACK.TEX", std::ifstream::in | std::ifstream::binary );
+	Mesh				mesh;		// world space, a single primitive
+	int32_t				cell[3];
+	std::vector<size_t> objects;	// the object ids used in mesh.objectIds
+	Bounds				bounds;		// of the batch's own vertices, not the whole objects
+};
 
-	if ( !fileTextureIndex.is_open() )
+// meshes[o] belongs to objects[o], its primitives go to the batch of their texture in the object's cell
+std::vector<ObjectBatch> batchObjects( const std::vector<Object> &objects, const std::vector<Mesh> &meshes )
+{
+	// ordered by texture then cell, so the batches come out the same every run
+	std::map<std::tuple<int, int32_t, int32_t, int32_t>, std::vector<std::pair<size_t, size_t>>> groups;
+	for ( size_t o = 0; o < meshes.size() && o < objects.size(); o++ )
 	{
-		printText( "Error! LIBRARY.TFF is missing or corrupt!" ); 
-		system("pause");
-		std::exit(0);
+		const Bounds &bounds = objects[o].bounds;
+		const float center[3] = { bounds_isEmpty( bounds ) ? meshes[o].translation.x : bounds.center[0],
+			bounds_isEmpty( bounds ) ? meshes[o].translation.y : bounds.center[1],
+			bounds_isEmpty( bounds ) ? meshes[o].translation.z : bounds.center[2] };
+		int32_t cell[3];
+		for ( int k = 0; k < 3; k++ )
+			cell[k] = (int32_t)floorf( center[k] / BATCH_CELL_SIZE );
+
+		for ( size_t p = 0; p < meshes[o].primitives.size(); p++ )
+		{
+			if ( meshes[o].primitives[p].indices.size() )
+				groups[std::make_tuple( meshes[o].primitives[p].texture, cell[0], cell[1], cell[2] )].push_back( std::make_pair( o, p ) );
+		}
 	}
 
-	int textureindexOffset = 0;
-	int indexEntries = ( getFileSize( "LIBRARY.TTF" ) / sizeof( TrackTextureIndex ) );
-
-	for ( int i = 0; i < indexEntries; i++ )
+	std::vector<ObjectBatch> batches;
+	std::vector<uint32_t> remap;
+	for ( auto group = groups.begin(); group != groups.end(); ++group )
 	{
-		TrackTextureIndex textureindexHeader;
-		fileTextureIndex.seekg( textureindexOffset );
-		fileTextureIndex.read((char*)(&textureindexHeader), sizeof(textureindexHeader));
-		// big endian -> little endian
-		endswap(&textureindexHeader.nearest);
-		endswap(&textureindexHeader.mediumest);
-		endswap(&textureindexHeader.farthest);
-		textureindexOffset += sizeof(textureindexHeader);
-		// i don't know why this array is being read backwards...
-		int size = sizeof(textureindexHeader.nearest) / sizeof(textureindexHeader.nearest[0]);
-		reverse(textureindexHeader.nearest, size);
-		theTrack.textureIndex.push_back(textureindexHeader);
-	}
-
-	// 4x4 32px tiles
-	std::vector<Image> composedImages;
+		bool bOpen = false;
+		for ( size_t i = 0; i < group->second.size(); i++ )
+		{
+			size_t o = group->second[i].first;
+			const Mesh &mesh = meshes[o];
+			const MeshPrimitive &primitive = mesh.primitives[group->second[i].second];
+
+			// only the vertices this primitive uses
+			remap.assign( mesh.vertices.size(), UINT32_MAX );
+			size_t used = 0;
+			for ( size_t j = 0; j < primitive.indices.size(); j++ )
+			{
+				if ( remap[primitive.indices[j]] == UINT32_MAX )
+					remap[primitive.indices[j]] = (uint32_t)used++;
+			}
 
-	for ( unsigned int i = 0; i < theTrack.textureIndex.size(); i++ )
-	{
-		TrackTextureIndex idx = theTrack.textureIndex[i];
-		std::vector<uint8_t> composedImage;
+			// an object too big for a batch still gets one of its own
+			if ( !bOpen || batches.back().mesh.vertices.size() + used > BATCH_MAX_VERTICES )
+			{
+				ObjectBatch batch;
+				batch.mesh.name = "batch_" + std::to_string( batches.size() );
+				batch.mesh.translation = { 0, 0, 0 };
+				batch.mesh.primitives.resize( 1 );
+				batch.mesh.primitives[0].texture = std::get<0>( group->first );
+				batch.cell[0] = std::get<1>( group->first );
+				batch.cell[1] = std::get<2>( group->first );
+				batch.cell[2] = std::get<3>( group->first );
+				batches.push_back( batch );
+				bOpen = true;
+			}
 
-		for ( int x = 0; x < 4; x++ ) 
-		{
-			for ( int y = 0; y < 4; y++ ) 
-			{		
-				std::vector<uint8_t> ctx = images[idx.nearest[y * 4 + x]].pixels;
-				for ( unsigned int j = 0; j < ctx.size(); j++ )
-				{
-					composedImage.push_back(ctx[j]);
-				}
+			ObjectBatch &batch = batches.back();
+			uint32_t base = (uint32_t)batch.mesh.vertices.size();
+			batch.mesh.vertices.resize( base + used );
+			batch.mesh.objectIds.resize( base + used, (uint32_t)o );
+			for ( size_t v = 0; v < mesh.vertices.size(); v++ )
+			{
+				if ( remap[v] == UINT32_MAX )
+					continue;
+				MeshVertex vertex = mesh.vertices[v];
+				vertex.position[0] += mesh.translation.x;
+				vertex.position[1] += mesh.translation.y;
+				vertex.position[2] += mesh.translation.z;
+				batch.mesh.vertices[base + remap[v]] = vertex;
 			}
-		}
+			for ( size_t j = 0; j < primitive.indices.size(); j++ )
+				batch.mesh.primitives[0].indices.push_back( base + remap[primitive.indices[j]] );
 
-		Image canvas;
-		canvas.pixels = composedImage;
-		canvas.width = 128;
-		canvas.height = 128; 
-		composedImages.push_back(canvas);
+			if ( batch.objects.empty() || batch.objects.back() != o )
+				batch.objects.push_back( o );
+		}
 	}
 
-	theTrack.images = composedImages;
-	
-	if ( !fileVertices.is_open() )
+	// an object can have primitives in several batches, so only the vertices that came along count
+	for ( size_t b = 0; b < batches.size(); b++ )
 	{
-		printText( "Error! TRACK.TRV is missing or corrupt!" );
-		system("pause");
-		std::exit(0);
+		const Mesh &mesh = batches[b].mesh;
+		batches[b].bounds = bounds_floats( mesh.vertices[0].position, sizeof(MeshVertex) / sizeof(float), mesh.vertices.size() );
 	}
 
-	int vertexOffset = 0;
-	int vertexCount = ( getFileSize( "TRACK.TRV" ) / sizeof( TrackVertex ) );
+	return batches;
+}
 
-	std::vector<TrackVertex> rawVertices;
+// one .glb with a node per batch and a manifest of what went where
+void writeObjectBatches( const std::vector<Object> &objects, const std::vector<Mesh> &meshes, const std::vector<Image> &images, const std::string &path, const std::string &prefix )
+{
+	printText( "Writing object batches ..." );
 
-	for ( int i = 0; i < vertexCount; i++ )
-	{
-		TrackVertex vertexHeader;
-		fileVertices.seekg( vertexOffset );
-		fileVertices.read((char*)(&vertexHeader), sizeof(vertexHeader));
-		// big endian -> little endian
-		endswap(&vertexHeader.x);
-		endswap(&vertexHeader.y);
-		endswap(&vertexHeader.z);
-		endswap(&vertexHeader.padding);
-		vertexOffset += sizeof(vertexHeader);
-		rawVertices.push_back( vertexHeader );
-	}
+	std::vector<ObjectBatch> batches = batchObjects( objects, meshes );
 
-	for ( size_t i = 0; i < rawVertices.size(); i++ )
+	std::vector<Mesh> batchMeshes( batches.size() );
+	std::vector<Bounds> bounds( batches.size() );
+	for ( size_t b = 0; b < batches.size(); b++ )
 	{
-#if 0
-		rawVertices[i].y *= -1;
-		rawVertices[i].z *= -1;
-#endif
-		theTrack.vertices.push_back( rawVertices[i] );
+		batchMeshes[b] = batches[b].mesh;
+		bounds[b] = batches[b].bounds;
 	}
-	if ( !fileFaces.is_open() )
+
+	std::string filename = path + prefix + "batches.glb";
+	if ( !glb_write( filename.c_str(), batchMeshes, images, &bounds ) )
 	{
-		printText( "Error! TRACK.TRF is missing or corrupt!" );
-		system("pause");
-		std::exit(0);
+		printLine( "Error! could not write ", filename );
+		return;
 	}
 
-	int faceOffset = 0;
-	int faceCount = ( getFileSize( "TRACK.TRF" ) / sizeof( TrackFace ) );
-	std::vector<TrackFace> faces;
+	ObjWriter json( path + prefix + "batches.json", 64 * 1024 );
+	json << "{" << "\n";
+	json << "\t\"file\": \"" << prefix << "batches.glb\"," << "\n";
+	json << "\t\"cellSize\": " << BATCH_CELL_SIZE << "," << "\n";
+
+	// the _OBJECT_ID vertex attribute indexes this
+	json << "\t\"objects\": [";
+	for ( size_t o = 0; o < objects.size(); o++ )
+		json << ( o ? ", " : "" ) << glb_string( meshes[o].name );
+	json << "]," << "\n";
 
-	for ( int i = 0; i < faceCount; i++ )
+	json << "\t\"batches\": [" << "\n";
+	for ( size_t b = 0; b < batches.size(); b++ )
 	{
-		TrackFace faceHeader;
-		fileFaces.seekg( faceOffset );
-		fileFaces.read((char*)&faceHeader, sizeof(faceHeader));
-		endswap(&faceHeader.indices);
-		endswap(&faceHeader.normalx);
-		endswap(&faceHeader.normaly);
-		endswap(&faceHeader.normalz);
-		endswap(&faceHeader.color);
-		faceOffset += sizeof(faceHeader);
-		faces.push_back(faceHeader);
+		const ObjectBatch &batch = batches[b];
+		json << "\t\t{ \"name\": \"" << batch.mesh.name << "\", \"texture\": " << batch.mesh.primitives[0].texture
+			<< ", \"cell\": [" << batch.cell[0] << ", " << batch.cell[1] << ", " << batch.cell[2] << "]"
+			<< ", \"vertices\": " << batch.mesh.vertices.size() << ", \"triangles\": " << batch.mesh.primitives[0].indices.size() / 3 << ", ";
+		writeBoundsJSON( json, batch.bounds );
+		json << ", \"objects\": [";
+		for ( size_t i = 0; i < batch.objects.size(); i++ )
+			json << ( i ? ", " : "" ) << batch.objects[i];
+		json << "] }" << ( b + 1 < batches.size() ? "," : "" ) << "\n";
 	}
+	json << "\t]" << "\n";
+	json << "}" << "\n";
+	json.close();
 
-	if ( bSequel )
+	size_t drawCalls = 0;
+	for ( size_t m = 0; m < meshes.size(); m++ )
 	{
-		if ( !fileTrackTexture.is_open() )
-		{
-			printText( "Error! TRACK.TEX is missing or corrupt!" );
-			system("pause");
-			std::exit(0);
-		}	
+		for ( size_t p = 0; p < meshes[m].primitives.size(); p++ )
+			drawCalls += meshes[m].primitives[p].indices.size() > 0;
+	}
+	printLine( filename, ": ", drawCalls, " draw calls -> ", batches.size(), " batches" );
+}
+
+//
+// export
+//
 
-		int trackTextureOffset = 0;
-		int trackTextureCount = ( getFileSize( "TRACK.TEX" ) / sizeof( TrackTexture ) );
-		std::vector<TrackTexture> trackTextures;
+// one parsed track or object set, every sink reads it and none may change it
+struct ExportSet
+{
+	std::string				   path;			// output folder, with the trailing slash
+	std::string				   prefix;			// file name prefix, e.g. "object_"
+	const Track				  *track = NULL;	// either a track...
+	const std::vector<Object> *objects = NULL;	// ...or objects, textures only when both are NULL
+	const std::vector<Object> *scenery = NULL;	// the SCENE.PRM objects around the track
+	const std::vector<Image>  *images = NULL;
+	std::vector<Mesh>		   meshes;			// built once for the sinks that need them, welded with --weld
+	std::vector<Mesh>		   chunkMeshes;		// the track split in chunks of --chunk-sections sections
+	TrackBVH				   bvh;				// over the track, built once for the sinks that query it
+};
 
-		for ( int i = 0; i < trackTextureCount; i++ )
-		{
-			TrackTexture trackTextureHeader;
-			fileTrackTexture.seekg( trackTextureOffset );
-			fileTrackTexture.read((char*)(&trackTextureHeader), sizeof(trackTextureHeader));
-			trackTextureOffset += sizeof(trackTextureHeader);
-			trackTextures.push_back( trackTextureHeader );
-		}
+// an output format, sinks run concurrently so they may only write their own files
+struct ExportSink
+{
+	const char *name;
+	bool		bMeshes;		// needs ExportSet::meshes
+	bool		bChunkMeshes;	// needs ExportSet::chunkMeshes
+	bool		bBVH;			// needs ExportSet::bvh
+	void	  (*write)( const ExportSet &set );
+};
 
-		for ( size_t i = 0; i < faces.size(); i++ )
-		{
-			faces[i].tile = trackTextures[i].tile;
-			faces[i].flags = trackTextures[i].flags;
-		}
-	}
+void textureSink( const ExportSet &set )
+{
+	if ( set.track )
+		writeTrackImages( *set.track );
+	else if ( set.images )
+		writeObjectImages( *set.images, set.prefix.c_str(), set.path.c_str() );
+}
 
-	for ( size_t i = 0; i < faces.size(); i++ )
-	{
-		theTrack.faces.push_back( faces[i] );
-	}
+void objSink( const ExportSet &set )
+{
+	if ( set.track )
+		writeTrack( *set.track, set.meshes );
+	else if ( set.objects )
+		writeObjects( *set.objects, *set.images, set.meshes, set.prefix.c_str(), set.path.c_str() );
+}
+
+void gltfSink( const ExportSet &set )
+{
+	if ( set.track )
+		writeTrackGLB( *set.track, set.meshes, ( set.path + "track.glb" ).c_str() );
+	else if ( set.objects )
+		writeObjectsGLB( *set.objects, set.meshes, *set.images, ( set.path + set.prefix + "model.glb" ).c_str() );
+}
 
-	int sectionOffset = 0;
-	int sectionCount = ( getFileSize( "TRACK.TRS" ) / sizeof( TrackSection ) );
-	std::vector<TrackSection> sections;
+void plySink( const ExportSet &set )
+{
+	if ( set.track )
+		writePLY( set.meshes, ( set.path + "track.ply" ).c_str() );
+	else if ( set.objects )
+		writePLY( set.meshes, ( set.path + set.prefix + "model.ply" ).c_str() );
+}
+
+// tracks go per chunk of sections, so the positions fit in int16
+void wmshSink( const ExportSet &set )
+{
+	std::string filename;
+	size_t bytes = 0;
 
-	for ( int i = 0; i < sectionCount; i++ )
+	if ( set.track )
 	{
-		TrackSection sectionHeader;
-		fileSections.seekg( sectionOffset );
-		fileSections.read((char*)&sectionHeader, sizeof(sectionHeader));
-		endswap(&sectionHeader.nextJunction);
-		endswap(&sectionHeader.previous);
-		endswap(&sectionHeader.next);
-		endswap(&sectionHeader.x);
-		endswap(&sectionHeader.y);
-		endswap(&sectionHeader.z);
-		endswap(&sectionHeader.firstFace);
-		endswap(&sectionHeader.numFaces);
-		endswap(&sectionHeader.flag);
-		sectionOffset += sizeof(sectionHeader);
-		sections.push_back(sectionHeader);
+		filename = set.path + "track.wmsh";
+		bytes = wmsh_write( filename.c_str(), set.chunkMeshes );
 	}
-
-	for ( size_t i = 0; i < sections.size(); i++ )
+	else if ( set.objects )
 	{
-		theTrack.sections.push_back( sections[i] );
+		filename = set.path + set.prefix + "model.wmsh";
+		bytes = wmsh_write( filename.c_str(), set.meshes );
 	}
+	else
+		return;
 
-	fileTextureIndex.close();
-	fileVertices.close();
-	fileFaces.close();
-	fileSections.close();
-	if ( bSequel )
-		fileTrackTexture.close();
+	if ( !bytes )
+		printLine( "Error! could not write ", filename );
+	else
+		printLine( filename, ": ", bytes, " bytes" );
+}
 
-	return theTrack;
+void chunksSink( const ExportSet &set )
+{
+	if ( set.track )
+		writeTrackChunks( *set.track, set.chunkMeshes, set.scenery, set.path );
 }
 
-void writeTrack( Track& theTrack )
+void pvsSink( const ExportSet &set )
 {
-	// NOTE: this uses the Goldeneye OBJ format, due to it supporting vertex colors, which normal OBJ does not.
+	if ( set.track )
+		writeTrackPVS( *set.track, set.bvh, ( set.path + "track_pvs.bin" ).c_str() );
+}
 
-	printText( "Writing OBJ file to track.obj ..." );
+void boundsSink( const ExportSet &set )
+{
+	if ( set.track )
+		writeTrackBounds( *set.track, ( set.path + "track_bounds.json" ).c_str() );
+	else if ( set.objects )
+		writeObjectBounds( *set.objects, ( set.path + set.prefix + "bounds.json" ).c_str() );
+}
 
-	std::ofstream obj("ripped_track/track.obj");
+// objects only, the track mesh already has one primitive per texture
+void batchSink( const ExportSet &set )
+{
+	if ( set.objects )
+		writeObjectBatches( *set.objects, set.meshes, *set.images, set.path, set.prefix );
+}
 
-	std::vector<UV> vertextexcoords;
-	std::vector<Color> vertexcolors;
+void lodSink( const ExportSet &set )
+{
+	if ( set.track )
+		writeTrackLods( *set.track, set.path );
+}
 
-	obj << "mtllib track.mtl"
-		<< "\n";
+void graphSink( const ExportSet &set )
+{
+	if ( set.track )
+		writeTrackGraph( *set.track, set.path );
+}
 
-	// write out the vertices
-	for ( size_t i = 0; i < theTrack.vertices.size(); i++ )
+void bvhSink( const ExportSet &set )
+{
+	if ( set.track )
+		writeTrackBVH( set.bvh, ( set.path + "track.bvh" ).c_str() );
+}
+
+const ExportSink exportSinks[] =
+{
+	{ "textures",	false,	false,	false,	textureSink },
+	{ "obj",		false,	false,	false,	objSink },
+	{ "gltf",		true,	false,	false,	gltfSink },
+	{ "ply",		true,	false,	false,	plySink },
+	{ "wmsh",		true,	true,	false,	wmshSink },
+	{ "bvh",		false,	false,	true,	bvhSink },
+	{ "chunks",		true,	true,	false,	chunksSink },
+	{ "graph",		false,	false,	false,	graphSink },
+	{ "lod",		false,	false,	false,	lodSink },
+	{ "pvs",		false,	false,	true,	pvsSink },
+	{ "bounds",		false,	false,	false,	boundsSink },
+	{ "batch",		true,	false,	false,	batchSink },
+};
+
+const ExportSink *findSink( const std::string &name )
+{
+	for ( size_t i = 0; i < sizeof(exportSinks) / sizeof(exportSinks[0]); i++ )
 	{
-		obj << "v " << theTrack.vertices[i].x << " " << theTrack.vertices[i].y << " " << theTrack.vertices[i].z << "\n";
+		if ( name == exportSinks[i].name )
+			return &exportSinks[i];
 	}
+	return NULL;
+}
 
-	// read texcoords and vertexcolors from faces
-	for ( size_t i = 0; i < theTrack.faces.size(); i++ )	
+// --weld and --vcache on freshly built meshes
+void processExportMeshes( std::vector<Mesh> &meshes, const std::string &what )
+{
+	if ( options.bWeld )
 	{
-		Color vertexcolor = int32ToColor( theTrack.faces[i].color );
+		std::vector<size_t> corners( meshes.size() );
+		parallelFor( meshes.size(), [&]( size_t m )
+		{
+			corners[m] = weldMesh( meshes[m] );
+		} );
 
-		if ( theTrack.faces[i].flags & BOOST )
+		size_t before = 0, after = 0;
+		for ( size_t m = 0; m < meshes.size(); m++ )
 		{
-			vertexcolor.r = 32;
-			vertexcolor.g = 32;
-			vertexcolor.b = 255;
+			before += corners[m];
+			after += meshes[m].vertices.size();
 		}
+		printWeldStats( what, before, after );
+	}
 
-		vertexcolors.push_back( vertexcolor );
-
-		int flipx = 0;
-
-		if ( theTrack.faces[i].flags & FLIP )
-			flipx = 1;
+	if ( options.bVertexCache )
+	{
+		std::vector<size_t> missesBefore( meshes.size() ), missesAfter( meshes.size() );
+		parallelFor( meshes.size(), [&]( size_t m )
+		{
+			missesBefore[m] = vertexCacheMisses( meshes[m] );
+			optimizeMesh( meshes[m] );
+			missesAfter[m] = vertexCacheMisses( meshes[m] );
+		} );
 
-		UV uv;
-		uv.u = 1 - flipx; uv.v = 0;
-		vertextexcoords.push_back( uv );
-		uv.u = 0 + flipx; uv.v = 0;
-		vertextexcoords.push_back( uv );
-		uv.u = 0 + flipx; uv.v = 1;
-		vertextexcoords.push_back( uv );
-		uv.u = 1 - flipx; uv.v = 1;
-		vertextexcoords.push_back( uv );
+		size_t before = 0, after = 0, triangles = 0;
+		for ( size_t m = 0; m < meshes.size(); m++ )
+		{
+			before += missesBefore[m];
+			after += missesAfter[m];
+			for ( size_t p = 0; p < meshes[m].primitives.size(); p++ )
+				triangles += meshes[m].primitives[p].indices.size() / 3;
+		}
+		if ( triangles )
+			printLine( what, " acmr ", (float)before / triangles, " -> ", (float)after / triangles );
 	}
+}
 
-	// write out the vertex texcoords
-	for ( size_t i = 0; i < vertextexcoords.size(); i++ )
+void buildExportMeshes( ExportSet &set, bool bChunks )
+{
+	if ( set.track )
 	{
-		obj << "vt " 
-			<< std::to_string(vertextexcoords[i].u) 
-			<< " " 
-			<< std::to_string(vertextexcoords[i].v) 
-			<< "\n";
+		set.meshes.push_back( buildTrackMesh( *set.track ) );
+		if ( bChunks )
+			set.chunkMeshes = buildTrackChunkMeshes( *set.track, options.chunkSections );
 	}
-
-	// write out the vertex vcolors
-	for ( size_t i = 0; i < vertexcolors.size(); i++ )
+	else if ( set.objects )
 	{
-		obj 
-			<< "#vcolor" 
-			<< " " << std::to_string(vertexcolors[i].r) 
-			<< " " << std::to_string(vertexcolors[i].g) 
-			<< " " << std::to_string(vertexcolors[i].b) 
-			<< "\n";
+		std::vector<UVTransform> uvTransforms = buildUVTransforms( *set.images );
+		set.meshes.resize( set.objects->size() );
+		parallelFor( set.objects->size(), [&]( size_t o )
+		{
+			set.meshes[o] = buildObjectMesh( ( *set.objects )[o], uvTransforms );
+		} );
 	}
 
-	int j = 1;
+	processExportMeshes( set.meshes, set.track ? "track" : set.prefix );
+	if ( set.chunkMeshes.size() )
+		processExportMeshes( set.chunkMeshes, "track chunks" );
+}
 
-	obj << "s off" << "\n";
+// hands the parsed sets to every selected sink, each set and sink pair is one job
+void runExports( std::vector<ExportSet> &sets )
+{
+	std::vector<const ExportSink*> sinks;
+	bool bMeshes = options.bWeld;
+	bool bChunks = false;
+	bool bBVH = false;
 
-	// write out the faces
-	for ( size_t i = 0; i < theTrack.faces.size(); i++ )
+	for ( size_t i = 0; i < options.formats.size(); i++ )
 	{
-		obj << "usemtl track_" << std::to_string(theTrack.faces[i].tile) << "\n";
-
-		obj << "f " 
-			<< std::to_string( theTrack.faces[i].indices[0] + 1 ) 
-			<< "/" 
-			<< std::to_string( j )
-			<< "/" 
-			<< std::to_string( j ) 
-			<< " " ;
-		obj << std::to_string( theTrack.faces[i].indices[1] + 1 ) 
-			<< "/" 
-			<< std::to_string( j + 1 )
-			<< "/" 
-			<< std::to_string( j + 1 ) 
-			<< " " ;
-		obj << std::to_string( theTrack.faces[i].indices[2] + 1 )	
-			<< "/" 
-			<< std::to_string( j + 2 )
-			<< "/" 
-			<< std::to_string( j + 2 ) 
-			<< " " ;
-		obj << std::to_string( theTrack.faces[i].indices[3] + 1 ) 
-			<< "/" 
-			<< std::to_string( j + 3 )
-			<< "/" 
-			<< std::to_string( j + 3 ) 
-			<< " " ;
-		obj << "\n";
-
-		j += 4;
-
-		obj << "#fvcolorindex " << 
-			std::to_string(i + 1)
-			<< " " << 
-			std::to_string(i + 1)
-			<< " " << 
-			std::to_string(i + 1)
-			<< " " << 
-			std::to_string(i + 1)
-			<< "\n";
+		const ExportSink *sink = findSink( options.formats[i] );
+		if ( sink && std::find( sinks.begin(), sinks.end(), sink ) == sinks.end() )
+		{
+			sinks.push_back( sink );
+			bMeshes |= sink->bMeshes;
+			bChunks |= sink->bChunkMeshes;
+			bBVH |= sink->bBVH;
+		}
 	}
-	
-	obj.close();
-
-	// path
-#if SECTIONS_OBJ
-	std::ofstream objs("ripped_track/sections.obj");
 
-	for ( size_t i = 0; i < theTrack.sections.size(); i++ )
+	if ( bBVH )
 	{
-		objs << "v " << theTrack.sections[i].x << " " << theTrack.sections[i].y << " " << theTrack.sections[i].z << "\n";
+		parallelFor( sets.size(), [&]( size_t i )
+		{
+			if ( sets[i].track )
+				sets[i].bvh.build( *sets[i].track );
+		} );
 	}
 
-	objs.close();
-#endif
-
-	std::cout << "Track vertex count: " << std::to_string(theTrack.vertices.size()) << "\n";
-
-	printText( "OBJ file written successfully!" );
-
-	printText( "Writing MTL file to track.mtl ..." );
-
-	std::ofstream mtl("ripped_track/track.mtl");
-
-	for ( size_t i = 0; i < theTrack.textureIndex.size(); i++ )
+	if ( bMeshes )
 	{
-		mtl << "newmtl track_" << std::to_string(i) << "\n";
-		mtl << "map_Kd " << "track_" << std::to_string(i) << ".tga" << "\n" << "\n";
+		for ( size_t i = 0; i < sets.size(); i++ )
+			buildExportMeshes( sets[i], bChunks );
 	}
 
-	mtl.close();
-
-	printText("MTL file written successfully!");
+	parallelFor( sets.size() * sinks.size(), [&]( size_t job )
+	{
+		sinks[job % sinks.size()]->write( sets[job / sinks.size()] );
+	} );
 }
 
 //
 // application
 //
 
-int main()
+void printUsage()
+{
+	std::cout << "usage: wipeout_ripper [options]" << "\n";
+	std::cout << "  --object <name|index>  only rip this object from each .PRM, can be repeated" << "\n";
+	std::cout << "  --list-objects         print the object table of each .PRM" << "\n";
+	std::cout << "  --threads <n>          number of worker threads, defaults to one per core" << "\n";
+	std::cout << "  --formats <list>       comma separated outputs: textures, obj, gltf, ply, wmsh, bvh, chunks, graph, lod, pvs, bounds, batch (default textures,obj)" << "\n";
+	std::cout << "  --gltf                 same as adding gltf to the formats" << "\n";
+	std::cout << "  --weld                 merge vertices with the same position, uv and color" << "\n";
+	std::cout << "  --vcache               reorder triangles and vertices for the gpu vertex caches, implies --weld" << "\n";
+	std::cout << "  --morton               sort the track vertices and faces along a z-order curve" << "\n";
+	std::cout << "  --chunk-sections <n>   sections per chunk for the chunks and wmsh formats (default 1)" << "\n";
+	std::cout << "                         lod chunks are the fewest of these with at least " << ( 1 << TRACK_LOD_LEVELS ) << " sections" << "\n";
+}
+
+void parseOptions( int argc, char *argv[] )
+{
+	for ( int i = 1; i < argc; i++ )
+	{
+		std::string arg(argv[i]);
+
+		if ( arg == "--object" && i + 1 < argc )
+		{
+			ObjectSelector selector;
+			selector.name = argv[++i];
+			selector.index = -1;
+
+			// digits only, so a name like "12a" stays a name
+			if ( !selector.name.empty() && selector.name.find_first_not_of( "0123456789" ) == std::string::npos )
+			{
+				errno = 0;
+				unsigned long value = strtoul( selector.name.c_str(), NULL, 10 );
+				if ( errno != ERANGE && value <= INT_MAX )
+					selector.index = (int)value;
+			}
+			options.objects.push_back( selector );
+		}
+		else if ( arg == "--list-objects" )
+		{
+			options.bListObjects = true;
+		}
+		else if ( arg == "--threads" && i + 1 < argc )
+		{
+			options.threads = std::max( 0, atoi( argv[++i] ) );
+		}
+		else if ( arg == "--formats" && i + 1 < argc )
+		{
+			options.formats.clear();
+
+			std::stringstream list( argv[++i] );
+			std::string format;
+			while ( std::getline( list, format, ',' ) )
+			{
+				if ( !findSink( format ) )
+				{
+					std::cout << "Unknown format " << format << "\n";
+					printUsage();
+					std::exit(0);
+				}
+				options.formats.push_back( format );
+			}
+		}
+		else if ( arg == "--gltf" )
+		{
+			options.formats.push_back( "gltf" );
+		}
+		else if ( arg == "--weld" )
+		{
+			options.bWeld = true;
+		}
+		else if ( arg == "--vcache" )
+		{
+			// unwelded quads share no vertices, so there would be nothing to reorder, and the
+			// default .obj writers only go through the meshes when welding
+			options.bVertexCache = true;
+			options.bWeld = true;
+		}
+		else if ( arg == "--morton" )
+		{
+			options.bMorton = true;
+		}
+		else if ( arg == "--chunk-sections" && i + 1 < argc )
+		{
+			options.chunkSections = std::max( atoi( argv[++i] ), 1 );
+		}
+		else
+		{
+			std::cout << "Unknown option " << arg << "\n";
+			printUsage();
+			std::exit(0);
+		}
+	}
+}
+
+int main( int argc, char *argv[] )
 {
+	parseOptions( argc, argv );
+
 	printText( "Wipeout Ripper V1", true );
 
 	printText( "Input 0 for WIPEOUT TRACK, input 1 for WIPEOUT2097 TRACK, input 2 for COMMON data", true );
@@ -2490,9 +5001,12 @@ int main()
 				std::string folderfname(file_without_extension);
 				folderfname += "_";
 
-				// write!
-				writeObjectImages( objectimages, folderfname.c_str(), fname.c_str() );
+				std::vector<ExportSet> sets( 1 );
+				sets[0].path = fname;
+				sets[0].prefix = folderfname;
+				sets[0].images = &objectimages;
 
+				std::vector<Object> objects;
 				bool bFound = false;
 				// check if this has a corresponding .PRM file for polygon data
 				for ( size_t j = 0; j < filenames.size() && !bFound; j++ )
@@ -2501,11 +5015,14 @@ int main()
 					prmfile += ".PRM";
 					if ( filenames[j].find( prmfile ) != std::string::npos ) 
 					{
-						std::vector<Object> objects = loadObjects( prmfile.c_str() );
-						writeObjects( objects, objectimages, folderfname.c_str(), fname.c_str() );
+						objects = loadObjects( prmfile.c_str() );
+						sets[0].objects = &objects;
 						bFound = true;
 					}
 				}
+
+				// write!
+				runExports( sets );
 			} 
 			// extract .PRM files, skip if it has a corresponding .CMP
 			if ( filenames[i].find( ".PRM" ) != std::string::npos ) 
@@ -2554,7 +5071,13 @@ int main()
 					// write!
 					std::vector<Image> dummyimages;
 					std::vector<Object> objects = loadObjects(filenames[i].c_str());
-					writeObjects( objects, dummyimages, folderfname.c_str(), fname.c_str() );
+
+					std::vector<ExportSet> sets( 1 );
+					sets[0].path = fname;
+					sets[0].prefix = folderfname;
+					sets[0].objects = &objects;
+					sets[0].images = &dummyimages;
+					runExports( sets );
 				}
 			}
 		}
@@ -2570,6 +5093,11 @@ int main()
 		std::vector<Object> objects = loadObjects( "SCENE.PRM" );
 		std::vector<Object> sky = loadObjects( "SKY.PRM" );
 		Track track = loadTrack( trackimages );
+		if ( options.bMorton )
+		{
+			printText( "Sorting the track along a z-order curve..." );
+			mortonSortTrack( track );
+		}
 
 		printText( "Creating ripped folders..." );
 		CreateDirectory(L"ripped_track/", NULL);
@@ -2578,14 +5106,25 @@ int main()
 		CreateDirectory(L"ripped_sky/", NULL);
 
 		//writeRawTrackImages( images );
-		writeTrackImages( track );
-		writeTrack( track );
-
-		writeObjectImages( objectimages, "object_", "ripped_objects/" );
-		writeObjects( objects, objectimages, "object_", "ripped_objects/" );
-
-		writeObjectImages( skyimages, "sky_", "ripped_sky/" );
-		writeObjects( sky, skyimages, "sky_", "ripped_sky/" );
+		std::vector<ExportSet> sets( 3 );
+		sets[0].path = "ripped_track/";
+		sets[0].prefix = "track_";
+		sets[0].track = &track;
+		sets[0].images = &track.images;
+		sets[0].scenery = &objects;
+
+		sets[1].path = "ripped_objects/";
+		sets[1].prefix = "object_";
+		sets[1].objects = &objects;
+		sets[1].images = &objectimages;
+
+		sets[2].path = "ripped_sky/";
+		sets[2].prefix = "sky_";
+		sets[2].objects = &sky;
+		sets[2].images = &skyimages;
+
+		// every sink runs on the same parsed data
+		runExports( sets );
 	}
 
 	system("pause");
@@ -0,0 +1,140 @@
+//
+// Compact binary mesh (.wmsh) writer
+// Positions are int16 relative to an int32 origin per mesh, uvs uint16 unorm, colors rgba8 and the
+// indices are zigzag deltas of the previous index as varints. Everything is little endian.
+//
+// file:      "WMSH" | u16 version | u16 mesh count | meshes
+// mesh:      u8 name length | name | i32 origin[3] | u8 shift | varint vertex count
+//            | i16 position[3] * count | u16 uv[2] * count | u8 color[4] * count
+//            | varint primitive count | primitives
+// primitive: varint texture + 1 (0 = untextured) | varint index count | varint zigzag( index - previous )
+//
+// position = origin + ( quantised << shift ), the shift is only non zero when a mesh spans more than 64k units
+//
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "wipeout_definitions.h"
+
+#define WMSH_VERSION 1
+
+inline void wmsh_put16( std::vector<uint8_t> &out, uint16_t v )
+{
+	out.push_back( (uint8_t)v );
+	out.push_back( (uint8_t)( v >> 8 ) );
+}
+
+inline void wmsh_put32( std::vector<uint8_t> &out, uint32_t v )
+{
+	wmsh_put16( out, (uint16_t)v );
+	wmsh_put16( out, (uint16_t)( v >> 16 ) );
+}
+
+inline void wmsh_varint( std::vector<uint8_t> &out, uint32_t v )
+{
+	while ( v >= 0x80 )
+	{
+		out.push_back( (uint8_t)( v | 0x80 ) );
+		v >>= 7;
+	}
+	out.push_back( (uint8_t)v );
+}
+
+inline void wmsh_encode( std::vector<uint8_t> &out, const Mesh &mesh )
+{
+	size_t nameLength = std::min( mesh.name.size(), (size_t)255 );
+	out.push_back( (uint8_t)nameLength );
+	out.insert( out.end(), mesh.name.begin(), mesh.name.begin() + nameLength );
+
+	// the source data is integer, so rounding gets the original coordinates back
+	std::vector<int32_t> positions( mesh.vertices.size() * 3 );
+	const float translation[3] = { mesh.translation.x, mesh.translation.y, mesh.translation.z };
+	for ( size_t i = 0; i < mesh.vertices.size(); i++ )
+	{
+		for ( int k = 0; k < 3; k++ )
+			positions[i * 3 + k] = (int32_t)lroundf( mesh.vertices[i].position[k] + translation[k] );
+	}
+
+	// origin in the middle of the bounds, so the full int16 range is used both ways
+	int32_t origin[3] = { 0, 0, 0 };
+	int shift = 0;
+	for ( int k = 0; k < 3 && mesh.vertices.size(); k++ )
+	{
+		int64_t lo = positions[k], hi = positions[k];
+		for ( size_t i = 0; i < mesh.vertices.size(); i++ )
+		{
+			lo = std::min( lo, (int64_t)positions[i * 3 + k] );
+			hi = std::max( hi, (int64_t)positions[i * 3 + k] );
+		}
+		origin[k] = (int32_t)( ( lo + hi ) / 2 );
+		while ( ( ( hi - origin[k] ) >> shift ) > 32767 || ( ( lo - origin[k] ) >> shift ) < -32768 )
+			shift++;
+	}
+
+	for ( int k = 0; k < 3; k++ )
+		wmsh_put32( out, (uint32_t)origin[k] );
+	out.push_back( (uint8_t)shift );
+
+	wmsh_varint( out, (uint32_t)mesh.vertices.size() );
+	for ( size_t i = 0; i < mesh.vertices.size(); i++ )
+	{
+		for ( int k = 0; k < 3; k++ )
+			wmsh_put16( out, (uint16_t)(int16_t)( ( (int64_t)positions[i * 3 + k] - origin[k] ) >> shift ) );
+	}
+	for ( size_t i = 0; i < mesh.vertices.size(); i++ )
+	{
+		for ( int k = 0; k < 2; k++ )
+			wmsh_put16( out, (uint16_t)lroundf( std::min( std::max( mesh.vertices[i].uv[k], 0.0f ), 1.0f ) * 65535.0f ) );
+	}
+	for ( size_t i = 0; i < mesh.vertices.size(); i++ )
+		out.insert( out.end(), mesh.vertices[i].color, mesh.vertices[i].color + 4 );
+
+	wmsh_varint( out, (uint32_t)mesh.primitives.size() );
+	for ( size_t p = 0; p < mesh.primitives.size(); p++ )
+	{
+		const std::vector<uint32_t> &indices = mesh.primitives[p].indices;
+		wmsh_varint( out, (uint32_t)( mesh.primitives[p].texture + 1 ) );
+		wmsh_varint( out, (uint32_t)indices.size() );
+
+		int64_t previous = 0;
+		for ( size_t i = 0; i < indices.size(); i++ )
+		{
+			int64_t delta = (int64_t)indices[i] - previous;
+			wmsh_varint( out, (uint32_t)( ( delta << 1 ) ^ ( delta >> 63 ) ) );
+			previous = indices[i];
+		}
+	}
+}
+
+/// <summary> Writes the meshes as one .wmsh file, returns the number of bytes written or 0 on failure. </summary>
+inline size_t wmsh_write( const char *filename, const std::vector<Mesh> &meshes )
+{
+	std::vector<uint8_t> out;
+	out.insert( out.end(), { 'W', 'M', 'S', 'H' } );
+	wmsh_put16( out, WMSH_VERSION );
+	wmsh_put16( out, (uint16_t)meshes.size() );
+
+	for ( size_t m = 0; m < meshes.size(); m++ )
+		wmsh_encode( out, meshes[m] );
+
+	FILE *fp = NULL;
+#ifdef _MSC_VER
+	fopen_s( &fp, filename, "wb" );
+#else
+	fp = fopen( filename, "wb" );
+#endif
+	if ( fp == NULL )
+		return 0;
+
+	fwrite( out.data(), 1, out.size(), fp );
+	fclose( fp );
+
+	return out.size();
+}